@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define LE_FREQUENCY_RANKING
+#define LE_RANGE_CODER
+#include "../lite_encoding.h"
+#include "../test/default_font_atlas.h"
+#include "../tools/thread_pool.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+#define CORPUS_SIZE (1 << 20)
+#define MAX_REPETITIONS (256)
+
+typedef enum output_format
+{
+    format_table,
+    format_csv,
+    format_json
+} output_format;
+
+typedef struct corpus
+{
+    const char* name;
+    uint8_t* data;
+    size_t size;
+} corpus;
+
+typedef struct settings
+{
+    uint32_t warmup;
+    uint32_t repetitions;
+    uint32_t threads;
+    bool policies;      // compares the promotion policies
+    output_format format;
+} settings;
+
+typedef struct measure
+{
+    double median;
+    double p10;     // 10th percentile of the throughput, ie the slow runs
+    double best;
+} measure;
+
+typedef struct row
+{
+    const char* corpus;
+    const char* api;
+    const char* variant;
+    size_t size;
+    size_t compressed_size;
+    measure encode;
+    measure decode;
+} row;
+
+static uint8_t* g_compressed;
+static uint8_t* g_decoded;
+static size_t g_capacity;
+static uint32_t g_row_count;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static double now(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static uint32_t random_next(uint64_t* state)
+{
+    // xorshift64*, deterministic corpora across platforms
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static double random_float(uint64_t* state)
+{
+    return (random_next(state) >> 8) * (1.0 / 16777216.0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void generate_geometric(uint8_t* data, size_t size, uint64_t seed)
+{
+    // small values, P(v) = p * (1-p)^v
+    const double p = 0.3;
+    for (size_t i = 0; i < size; ++i)
+    {
+        double value = floor(log(1.0 - random_float(&seed)) / log(1.0 - p));
+        data[i] = (uint8_t)(value > 255.0 ? 255.0 : value);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void generate_zipf(uint8_t* data, size_t size, uint64_t seed)
+{
+    // 256 symbols with a zipf distribution (s = 1.1), symbols shuffled so the ranking has to be learned by the MTF
+    double cdf[256], sum = 0.0;
+    uint8_t symbols[256];
+
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        sum += 1.0 / pow((double)(i + 1), 1.1);
+        cdf[i] = sum;
+        symbols[i] = (uint8_t)i;
+    }
+
+    for (uint32_t i = 255; i > 0; --i)
+    {
+        uint32_t j = random_next(&seed) % (i + 1);
+        uint8_t tmp = symbols[i];
+        symbols[i] = symbols[j];
+        symbols[j] = tmp;
+    }
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        double u = random_float(&seed) * sum;
+        uint32_t low = 0, high = 255;
+        while (low < high)
+        {
+            uint32_t middle = (low + high) / 2;
+            if (cdf[middle] < u)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        data[i] = symbols[low];
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void generate_uniform(uint8_t* data, size_t size, uint64_t seed)
+{
+    for (size_t i = 0; i < size; ++i)
+        data[i] = (uint8_t)random_next(&seed);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void generate_runs(uint8_t* data, size_t size, uint64_t seed)
+{
+    // runs of a few symbols, mean run length of 16
+    size_t i = 0;
+    while (i < size)
+    {
+        uint8_t symbol = (uint8_t)(random_next(&seed) % 8) * 31;
+        size_t length = 1 + (size_t)floor(log(1.0 - random_float(&seed)) / log(1.0 - 1.0 / 16.0));
+        for (size_t j = 0; j < length && i < size; ++j)
+            data[i++] = symbol;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static measure summarize(double* throughput, uint32_t count)
+{
+    qsort(throughput, count, sizeof(double), compare_double);
+    measure result =
+    {
+        .median = throughput[count / 2],
+        .p10 = throughput[(count - 1) / 10],
+        .best = throughput[count - 1]
+    };
+    return result;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// single value functions, bulk functions, bulk functions with the zero-run mode (symbols only), bulk functions with the range coder,
+// order-1 context model (symbols only), bulk functions with the other promotion policies (symbols only)
+typedef enum variant {variant_single, variant_bulk, variant_runs, variant_range, variant_context,
+                      variant_front, variant_quarter, variant_step, variant_frequency} variant;
+static const char* variant_names[] = {"single", "bulk", "bulk+runs", "bulk+range", "context-o1",
+                                      "bulk-front", "bulk-quarter", "bulk-step", "bulk-frequency"};
+static const char* api_names[] = {"symbol", "literal", "delta"};
+static le_context_model g_context_model;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// the promotion policy is a compile time constant
+static void encode_symbols(le_stream* s, le_model* model, const corpus* c, variant v)
+{
+    switch (v)
+    {
+    case variant_front : le_encode_symbols_ex(s, model, c->data, c->size, le_promote_front); break;
+    case variant_quarter : le_encode_symbols_ex(s, model, c->data, c->size, le_promote_quarter); break;
+    case variant_step : le_encode_symbols_ex(s, model, c->data, c->size, le_promote_step); break;
+    case variant_frequency : le_encode_symbols_ex(s, model, c->data, c->size, le_promote_frequency); break;
+    default : le_encode_symbols(s, model, c->data, c->size); break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void decode_symbols(le_stream* s, le_model* model, const corpus* c, variant v)
+{
+    switch (v)
+    {
+    case variant_front : le_decode_symbols_ex(s, model, g_decoded, c->size, le_promote_front); break;
+    case variant_quarter : le_decode_symbols_ex(s, model, g_decoded, c->size, le_promote_quarter); break;
+    case variant_step : le_decode_symbols_ex(s, model, g_decoded, c->size, le_promote_step); break;
+    case variant_frequency : le_decode_symbols_ex(s, model, g_decoded, c->size, le_promote_frequency); break;
+    default : le_decode_symbols(s, model, g_decoded, c->size); break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static size_t encode(const corpus* c, le_api api, variant v)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, g_compressed, g_capacity);
+    le_model_init(&model);
+    if (v == variant_runs)
+        le_model_enable_runs(&model);
+    if (v == variant_range)
+        le_set_backend(&s, le_backend_range);
+    le_begin_encode(&s);
+
+    if (v == variant_context)
+    {
+        le_context_model_init(&g_context_model, 1);
+        le_encode_context_symbols(&s, &g_context_model, c->data, c->size);
+    }
+    else if (v != variant_single)
+    {
+        switch (api)
+        {
+        case le_api_symbol : encode_symbols(&s, &model, c, v); break;
+        case le_api_literal : le_encode_literals(&s, &model, c->data, c->size); break;
+        case le_api_delta : le_encode_deltas(&s, &model, (const int8_t*)c->data, c->size); break;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < c->size; ++i)
+        {
+            switch (api)
+            {
+            case le_api_symbol : le_encode_symbol(&s, &model, c->data[i]); break;
+            case le_api_literal : le_encode_literal(&s, &model, c->data[i]); break;
+            case le_api_delta : le_encode_delta(&s, &model, (int8_t)c->data[i]); break;
+            }
+        }
+    }
+
+    return le_end_encode(&s);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool decode(const corpus* c, size_t compressed_size, le_api api, variant v)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, g_compressed, compressed_size);
+    le_model_init(&model);
+    if (v == variant_runs)
+        le_model_enable_runs(&model);
+    if (v == variant_range)
+        le_set_backend(&s, le_backend_range);
+    le_begin_decode(&s);
+
+    if (v == variant_context)
+    {
+        le_context_model_init(&g_context_model, 1);
+        le_decode_context_symbols(&s, &g_context_model, g_decoded, c->size);
+    }
+    else if (v != variant_single)
+    {
+        switch (api)
+        {
+        case le_api_symbol : decode_symbols(&s, &model, c, v); break;
+        case le_api_literal : le_decode_literals(&s, &model, g_decoded, c->size); break;
+        case le_api_delta : le_decode_deltas(&s, &model, (int8_t*)g_decoded, c->size); break;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < c->size; ++i)
+        {
+            switch (api)
+            {
+            case le_api_symbol : g_decoded[i] = le_decode_symbol(&s, &model); break;
+            case le_api_literal : g_decoded[i] = le_decode_literal(&s, &model); break;
+            case le_api_delta : g_decoded[i] = (uint8_t)le_decode_delta(&s, &model); break;
+            }
+        }
+    }
+
+    le_end_decode(&s);
+    return s.status == LE_OK;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void print_row(const settings* config, const row* r)
+{
+    double ratio = (double)r->compressed_size / (double)r->size;
+    switch (config->format)
+    {
+    case format_table :
+        printf("%-10s %-8s %-14s %9zu %6.3f  %8.1f %8.1f %8.1f  %8.1f %8.1f %8.1f\n", r->corpus, r->api, r->variant, r->compressed_size, ratio,
+               r->encode.median, r->encode.p10, r->encode.best, r->decode.median, r->decode.p10, r->decode.best);
+        break;
+    case format_csv :
+        printf("%s,%s,%s,%zu,%zu,%.5f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", r->corpus, r->api, r->variant, r->size, r->compressed_size, ratio,
+               r->encode.median, r->encode.p10, r->encode.best, r->decode.median, r->decode.p10, r->decode.best);
+        break;
+    case format_json :
+        printf("%s\n    {\"corpus\": \"%s\", \"api\": \"%s\", \"variant\": \"%s\", \"size\": %zu, \"compressed_size\": %zu, \"ratio\": %.5f, "
+               "\"encode_mbs\": {\"median\": %.2f, \"p10\": %.2f, \"best\": %.2f}, \"decode_mbs\": {\"median\": %.2f, \"p10\": %.2f, \"best\": %.2f}}",
+               g_row_count ? "," : "", r->corpus, r->api, r->variant, r->size, r->compressed_size, ratio,
+               r->encode.median, r->encode.p10, r->encode.best, r->decode.median, r->decode.p10, r->decode.best);
+        break;
+    }
+    g_row_count++;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool bench_stream(const settings* config, const corpus* c, le_api api, variant v)
+{
+    double encode_throughput[MAX_REPETITIONS], decode_throughput[MAX_REPETITIONS];
+    size_t compressed_size = 0;
+    double megabytes = (double)c->size / 1e6;
+
+    for (uint32_t i = 0; i < config->warmup; ++i)
+        compressed_size = encode(c, api, v);
+
+    for (uint32_t i = 0; i < config->repetitions; ++i)
+    {
+        double start = now();
+        compressed_size = encode(c, api, v);
+        encode_throughput[i] = megabytes / (now() - start);
+    }
+
+    if (compressed_size == 0)
+    {
+        fprintf(stderr, "%s/%s : encoding failed\n", c->name, api_names[api]);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < config->warmup; ++i)
+        decode(c, compressed_size, api, v);
+
+    for (uint32_t i = 0; i < config->repetitions; ++i)
+    {
+        double start = now();
+        decode(c, compressed_size, api, v);
+        decode_throughput[i] = megabytes / (now() - start);
+    }
+
+    if (!decode(c, compressed_size, api, v) || memcmp(c->data, g_decoded, c->size) != 0)
+    {
+        fprintf(stderr, "%s/%s : round trip failed\n", c->name, api_names[api]);
+        return false;
+    }
+
+    row r =
+    {
+        .corpus = c->name, .api = api_names[api], .variant = variant_names[v],
+        .size = c->size, .compressed_size = compressed_size,
+        .encode = summarize(encode_throughput, config->repetitions),
+        .decode = summarize(decode_throughput, config->repetitions)
+    };
+    print_row(config, &r);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// bit-cost estimation of the bulk functions : the size must match the bulk row, the encode columns report the throughput
+// of the estimation (nothing to decode)
+static bool bench_estimate(const settings* config, const corpus* c, le_api api)
+{
+    double throughput[MAX_REPETITIONS], none[MAX_REPETITIONS] = {0};
+    double megabytes = (double)c->size / 1e6;
+    uint64_t bits = 0;
+
+    for (uint32_t i = 0; i < config->warmup + config->repetitions; ++i)
+    {
+        le_model model;
+        le_model_init(&model);
+
+        double start = now();
+        bits = le_estimate(&model, c->data, c->size, api);
+        if (i >= config->warmup)
+            throughput[i - config->warmup] = megabytes / (now() - start);
+    }
+
+    size_t compressed_size = (size_t)((bits + 7) / 8);
+    if (compressed_size != encode(c, api, variant_bulk))
+    {
+        fprintf(stderr, "%s/%s : estimate doesn't match the encoded size\n", c->name, api_names[api]);
+        return false;
+    }
+
+    row r =
+    {
+        .corpus = c->name, .api = api_names[api], .variant = "estimate",
+        .size = c->size, .compressed_size = compressed_size,
+        .encode = summarize(throughput, config->repetitions),
+        .decode = summarize(none, config->repetitions)
+    };
+    print_row(config, &r);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// block mode : reports the ratio lost with the model resets and the multi-threaded throughput
+static bool bench_blocks(const settings* config, const corpus* c, uint32_t threads)
+{
+    static char variant[32];
+    double encode_throughput[MAX_REPETITIONS], decode_throughput[MAX_REPETITIONS];
+    double megabytes = (double)c->size / 1e6;
+    size_t compressed_size = 0;
+    le_parallel_for_func parallel_for = NULL;
+
+#if defined(THREAD_POOL)
+    if (threads > 1)
+        parallel_for = parallel_for_threads;
+#endif
+
+    for (uint32_t i = 0; i < config->warmup + config->repetitions; ++i)
+    {
+        double start = now();
+        compressed_size = le_encode_blocks(c->data, c->size, g_compressed, g_capacity, LE_BLOCK_SIZE, le_api_symbol, parallel_for, &threads);
+        if (i >= config->warmup)
+            encode_throughput[i - config->warmup] = megabytes / (now() - start);
+    }
+
+    for (uint32_t i = 0; i < config->warmup + config->repetitions; ++i)
+    {
+        double start = now();
+        bool success = le_decode_blocks(g_compressed, compressed_size, g_decoded, c->size, LE_BLOCK_SIZE, le_api_symbol, parallel_for, &threads);
+        if (i >= config->warmup)
+            decode_throughput[i - config->warmup] = megabytes / (now() - start);
+
+        if (!success || compressed_size == 0)
+        {
+            fprintf(stderr, "%s/blocks : round trip failed\n", c->name);
+            return false;
+        }
+    }
+
+    if (memcmp(c->data, g_decoded, c->size) != 0)
+    {
+        fprintf(stderr, "%s/blocks : round trip failed\n", c->name);
+        return false;
+    }
+
+    snprintf(variant, sizeof(variant), "blocks-%ut", threads);
+    row r =
+    {
+        .corpus = c->name, .api = "symbol", .variant = variant,
+        .size = c->size, .compressed_size = compressed_size,
+        .encode = summarize(encode_throughput, config->repetitions),
+        .decode = summarize(decode_throughput, config->repetitions)
+    };
+    print_row(config, &r);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void print_usage(void)
+{
+    printf("usage : bench [--csv | --json] [--reps N] [--warmup N] [--threads N] [--policies]\n"
+           "  throughput is reported in MB/s : median, 10th percentile and best run\n"
+           "  --policies adds the symbol rows of the other promotion policies\n");
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    settings config = {.warmup = 2, .repetitions = 11, .threads = 4, .format = format_table};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+            config.format = format_csv;
+        else if (strcmp(argv[i], "--json") == 0)
+            config.format = format_json;
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            config.repetitions = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            config.warmup = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            config.threads = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--policies") == 0)
+            config.policies = true;
+        else
+        {
+            print_usage();
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (config.repetitions == 0 || config.repetitions > MAX_REPETITIONS || config.threads == 0 || config.threads > MAX_THREADS)
+    {
+        print_usage();
+        return 1;
+    }
+
+    corpus corpora[] =
+    {
+        {.name = "font_atlas", .data = (uint8_t*)default_font_atlas, .size = default_font_atlas_size},
+        {.name = "geometric", .size = CORPUS_SIZE},
+        {.name = "zipf", .size = CORPUS_SIZE},
+        {.name = "uniform", .size = CORPUS_SIZE},
+        {.name = "runs", .size = CORPUS_SIZE},
+    };
+    const uint32_t corpus_count = sizeof(corpora) / sizeof(corpora[0]);
+
+    for (uint32_t i = 1; i < corpus_count; ++i)
+        corpora[i].data = (uint8_t*) malloc(corpora[i].size);
+
+    generate_geometric(corpora[1].data, corpora[1].size, 0x1234);
+    generate_zipf(corpora[2].data, corpora[2].size, 0x5678);
+    generate_uniform(corpora[3].data, corpora[3].size, 0x9abc);
+    generate_runs(corpora[4].data, corpora[4].size, 0xdef0);
+
+    g_capacity = le_blocks_bound(CORPUS_SIZE, LE_BLOCK_SIZE);
+    g_compressed = (uint8_t*) malloc(g_capacity);
+    g_decoded = (uint8_t*) malloc(CORPUS_SIZE);
+
+    switch (config.format)
+    {
+    case format_table :
+        printf("%-10s %-8s %-14s %9s %6s  %8s %8s %8s  %8s %8s %8s\n", "corpus", "api", "variant", "bytes", "ratio",
+               "enc med", "enc p10", "enc best", "dec med", "dec p10", "dec best");
+        break;
+    case format_csv :
+        printf("corpus,api,variant,size,compressed_size,ratio,encode_median,encode_p10,encode_best,decode_median,decode_p10,decode_best\n");
+        break;
+    case format_json :
+        printf("{\"repetitions\": %u, \"warmup\": %u, \"results\": [", config.repetitions, config.warmup);
+        break;
+    }
+
+    bool success = true;
+    for (uint32_t i = 0; i < corpus_count; ++i)
+    {
+        for (uint32_t api = le_api_symbol; api <= le_api_delta; ++api)
+        {
+            success &= bench_stream(&config, &corpora[i], (le_api)api, variant_single);
+            success &= bench_stream(&config, &corpora[i], (le_api)api, variant_bulk);
+            success &= bench_estimate(&config, &corpora[i], (le_api)api);
+            if (api == le_api_symbol)
+            {
+                success &= bench_stream(&config, &corpora[i], (le_api)api, variant_runs);
+                success &= bench_stream(&config, &corpora[i], (le_api)api, variant_context);
+                for (uint32_t v = variant_front; config.policies && v <= variant_frequency; ++v)
+                    success &= bench_stream(&config, &corpora[i], (le_api)api, (variant)v);
+            }
+            success &= bench_stream(&config, &corpora[i], (le_api)api, variant_range);
+        }
+
+        if (corpora[i].size > LE_BLOCK_SIZE)
+        {
+            success &= bench_blocks(&config, &corpora[i], 1);
+            if (config.threads > 1)
+                success &= bench_blocks(&config, &corpora[i], config.threads);
+        }
+    }
+
+    if (config.format == format_json)
+        printf("\n]}\n");
+
+    for (uint32_t i = 1; i < corpus_count; ++i)
+        free(corpora[i].data);
+    free(g_compressed);
+    free(g_decoded);
+
+    return success ? 0 : 1;
+}
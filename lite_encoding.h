@@ -53,6 +53,8 @@ USAGE:
  - Use le_encode_literal() for small numbers
  - You can create/use as many model as you want, it's better to specialize model on specific data
  - Test the status of the stream after encoding and decoding to catch errors
+ - With a padded buffer (le_init_padded), the *_unchecked() decoding functions skip the per-symbol bounds checks,
+   the stream is validated once by le_end_decode()
  */
 
 
@@ -64,9 +66,82 @@ USAGE:
 #include <string.h>
 #include <stdbool.h>
 
+#ifdef LE_STATS
+    #include <stdio.h>
+#endif
+
 #define LE_ALPHABET_SIZE (256)
 #define LE_K_TREND_THRESHOLD (12)
-#define LE_Q_ESCAPE_SIZE (10)
+#define LE_Q_ESCAPE_SIZE (8)
+#define LE_PADDING (8)
+#define LE_TABLE_BITS (12)
+#define LE_TABLE_MAX_K (2)
+#define LE_TABLE_MAX_VALUES (4)
+#define LE_PROMOTE_SIMD_MIN (16)
+#define LE_RUN_THRESHOLD (4)            // zero indices at k = 0 before entering run mode
+#define LE_RUN_INDEX_MAX (31)
+#define LE_RC_PROB_BITS (11)
+#define LE_RC_MOVE_BITS (5)             // probability adaptation speed
+#define LE_RC_TOP (1U << 24)
+#define LE_CONTEXT_COUNT (256)
+#define LE_MAX_CODE_BITS (25)           // longest codeword : 16 unary bits, stop bit and raw byte at k = 0
+#define LE_MAX_RUN_BREAK_BITS (16)      // zero-run mode : '0' and the longest run length, a run pending from the last call
+#define LE_MAX_WIDE16_CODE_BITS (33)    // longest codeword of the 16-bit values : 16 unary bits, stop bit and raw value
+#define LE_MAX_WIDE_CODE_BITS (49)      // longest codeword of the 32-bit values : 16 unary bits, stop bit and raw value
+#define LE_RC_MAX_SYMBOL_BITS (49)      // 8 binary decisions at the lowest probability (31/2048), 6.05 bits each
+#define LE_RC_FLUSH_BYTES (5)
+#define LE_BLOCK_SIZE (65536)
+#define LE_MAX_BLOCK_SIZE (1 << 28)     // compressed block sizes are stored on 32 bits
+#define LE_FRAME_MAGIC (0x434E454CU)    // "LENC"
+#define LE_FRAME_VERSION (1)
+#define LE_FRAME_HEADER_SIZE (24)
+#define LE_SNAPSHOT_MAGIC (0x534D454CU) // "LEMS"
+#define LE_SNAPSHOT_VERSION (3)
+#define LE_SNAPSHOT_SIZE (16 + LE_Q_ESCAPE_SIZE + LE_ALPHABET_SIZE)
+
+// worst case size in bytes of count values coded in one encoding session (le_begin_encode() to le_end_encode()),
+// every value taking the longest codeword. Constant expressions when count is, valid for all the 8-bit apis, with
+// or without zero-run mode : a model can start the session in a run left by a previous call, the first symbol then
+// pays the run break on top of its codeword. LE_MAX_ENCODED_SIZE_RANGE is the bound of the range coder backend.
+#define LE_MAX_ENCODED_SIZE(count) (((size_t)(count) * LE_MAX_CODE_BITS + LE_MAX_RUN_BREAK_BITS + 7) / 8)
+#define LE_MAX_ENCODED_SIZE16(count) (((size_t)(count) * LE_MAX_WIDE16_CODE_BITS + 7) / 8)
+#define LE_MAX_ENCODED_SIZE32(count) (((size_t)(count) * LE_MAX_WIDE_CODE_BITS + 7) / 8)
+#define LE_MAX_ENCODED_SIZE_RANGE(count) (((size_t)(count) * LE_RC_MAX_SYMBOL_BITS + 7) / 8 + LE_RC_FLUSH_BYTES)
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define LE_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define LE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define LE_NEON
+#endif
+
+#ifdef _MSC_VER
+    #define LE_FORCE_INLINE __forceinline
+#else
+    #define LE_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+// expands run(K) with a constant K for each possible k value, used to instantiate the bulk kernels. A k above 7 (a model
+// not initialized by le_model_init*() or le_model_load()) has no kernel, fail is executed instead of looping forever
+#define LE_SWITCH_K(k, run, fail) \
+    switch (k) \
+    { \
+        case 0 : run(0); break; \
+        case 1 : run(1); break; \
+        case 2 : run(2); break; \
+        case 3 : run(3); break; \
+        case 4 : run(4); break; \
+        case 5 : run(5); break; \
+        case 6 : run(6); break; \
+        case 7 : run(7); break; \
+        default : fail; break; \
+    }
+
 #ifdef _MSC_VER
     #include <intrin.h>
     #pragma intrinsic(_BitScanForward64)
@@ -80,14 +155,81 @@ USAGE:
     #define le_ctz64(mask) (uint32_t)__builtin_ctzll(mask)
 #endif
 
-static const uint8_t q_escape_for_k[LE_Q_ESCAPE_SIZE] = {16, 10, 4, 6, 255, 255, 255, 255, 255, 255};
+// publication of the tables built on first use : acquire load, release store and compare-and-swap on a long
+#ifdef _MSC_VER
+    #pragma intrinsic(_InterlockedCompareExchange, _InterlockedExchange)
+    #define le_atomic_load(ptr) _InterlockedCompareExchange((ptr), 0, 0)
+    #define le_atomic_store(ptr, value) _InterlockedExchange((ptr), (value))
+    #define le_atomic_cas(ptr, expected, desired) (_InterlockedCompareExchange((ptr), (desired), (expected)) == (expected))
+#else
+    #define le_atomic_load(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define le_atomic_store(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+    static inline bool le_atomic_cas(volatile long* ptr, long expected, long desired)
+    {
+        return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+#endif
+
+// escape limits : at q >= L the unary prefix is followed by the raw N-bit value, L + 1 + N bits instead of q + 1 + k,
+// L = 255 never escapes. The default tables are part of the format, changing them breaks the raw streams.
+// q_escape_tight is the break-even table of the 8-bit values, L = max(4, 8 - k) : the quotients below 8 - k code shorter
+// than the escape. 17 bits at most instead of 25, select it with le_model_set_escape() on both sides.
+static const uint8_t q_escape_for_k[LE_Q_ESCAPE_SIZE] = {16, 10, 4, 6, 255, 255, 255, 255};
+static const uint8_t q_escape_tight[LE_Q_ESCAPE_SIZE] = {8, 7, 6, 5, 4, 255, 255, 255};
+
+// wide values : the raw 16/32-bit escape is used past 16 ones, unless the unary prefix can't reach it
+static const uint8_t q_escape_for_k16[16] = {16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 255, 255, 255, 255};
+static const uint8_t q_escape_for_k32[32] = {16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+                                             16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 255, 255, 255, 255};
+
+// zero-run mode : log2 of the run segment length for each run index (JPEG-LS J table)
+static const uint8_t run_bits_for_index[LE_RUN_INDEX_MAX + 1] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                                                 4, 4, 5, 5, 6, 6, 7, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
 typedef enum le_status
 {
     LE_OK = 0,
-    LE_BUFFER_OVERRUN = -1
+    LE_BUFFER_OVERRUN = -1,
+    LE_IO_ERROR = -2,
+    LE_INVALID_FRAME = -3,
+    LE_INVALID_MODEL = -4,
+    LE_UNSUPPORTED_BACKEND = -5
 } le_status;
 
+// the functions used to code an array
+typedef enum le_api
+{
+    le_api_symbol,
+    le_api_literal,
+    le_api_delta
+} le_api;
+
+// how a coded symbol moves toward the front of the alphabet, both sides must use the same policy
+// a compile time constant : LE_PROMOTE_POLICY for the regular functions, a parameter of the *_ex() functions
+typedef enum le_promote_policy
+{
+    le_promote_half,        // to index / 2, not above k = 5
+    le_promote_front,       // to the front, classic move-to-front
+    le_promote_quarter,     // to index / 4
+    le_promote_step,        // one step, swapped with the previous symbol
+#ifdef LE_FREQUENCY_RANKING
+    le_promote_frequency    // alphabet sorted by symbol counts
+#endif
+} le_promote_policy;
+
+#ifndef LE_PROMOTE_POLICY
+    #define LE_PROMOTE_POLICY le_promote_half
+#endif
+
+// entropy coder of a stream, see le_set_backend()
+typedef enum le_backend
+{
+    le_backend_rice,
+#ifdef LE_RANGE_CODER
+    le_backend_range        // adaptive binary range coder, 512 more bytes per model
+#endif
+} le_backend;
+
 enum le_mode
 {
     le_mode_idle,
@@ -95,122 +237,242 @@ enum le_mode
     le_mode_decode
 };
 
+// receives a filled chunk of the output buffer, returns false to abort the encoding
+typedef bool (*le_write_func)(void* user_data, const uint8_t* data, size_t size);
+
+// fills the input buffer with the next chunk of the stream, returns the number of bytes read (0 at the end)
+typedef size_t (*le_read_func)(void* user_data, uint8_t* buffer, size_t capacity);
+
 typedef struct le_stream
 {
     uint8_t* buffer;
     size_t position;
     size_t size;
+    size_t capacity;
+    size_t padding;     // writable bytes after size, see le_init_padded()
+
+    le_write_func write;
+    le_read_func read;
+    void* write_user_data;
+    void* read_user_data;
+    size_t offset;      // bytes already handed to the sink or consumed from the source
+    bool eof;           // the source returned 0, it isn't called again
 
     uint64_t bit_reservoir;
     uint32_t bits_available;
 
+    le_backend backend;
+#ifdef LE_RANGE_CODER
+    uint64_t rc_low;        // range coder state
+    uint64_t rc_pending;    // bytes waiting for a possible carry
+    uint32_t rc_range;
+    uint32_t rc_code;
+    uint8_t rc_cache;
+#endif
+
     enum le_mode mode;
     le_status status;
 } le_stream;
 
+#ifdef LE_STATS
+// what a model is doing, encoding and decoding give the same numbers
+typedef struct le_model_stats
+{
+    uint64_t values;                            // values coded (symbols, literals or deltas)
+    uint64_t bits;                              // codewords length, rice backend only
+    uint64_t escapes;                           // values coded with the raw byte escape
+    uint64_t range_values;                      // values coded with the range coder, not counted in bits and escapes
+    uint64_t k_histogram[32];                   // k used for each value
+    uint64_t k_increases;
+    uint64_t k_decreases;
+    uint64_t index_histogram[LE_ALPHABET_SIZE]; // MTF index of each symbol
+    uint64_t promotions;                        // symbols moved toward the front
+    uint64_t promote_moves;                     // alphabet entries shifted by the promotions
+    uint64_t run_symbols;                       // symbols coded in zero-run mode
+} le_model_stats;
+#endif
+
+// soft-K adaptation parameters, see le_model_init_params()
+typedef struct le_k_params
+{
+    uint8_t initial_k;      // up to 7
+    uint8_t threshold;      // change signals before k changes, up to 126
+    uint8_t low;            // values below low << k vote for a smaller k
+    uint8_t high;           // values above high << k vote for a larger k
+    uint8_t fast_threshold; // dual-rate : consecutive signals in the same direction before k changes, 0 disables it, up to 126
+} le_k_params;
+
+// the compile-time defaults : k starts at 2 and changes after LE_K_TREND_THRESHOLD signals, below 1 << k or above 3 << k
+static const le_k_params le_default_k_params = {.initial_k = 2, .threshold = LE_K_TREND_THRESHOLD, .low = 1, .high = 3,
+                                                .fast_threshold = 0};
+
 typedef struct le_model
 {
     uint8_t alphabet[LE_ALPHABET_SIZE];
     uint8_t index[LE_ALPHABET_SIZE];
     uint8_t k;  // rice k-value
     int8_t k_trend;
+    int8_t k_fast_trend;
+    le_k_params k_params;
+    uint8_t q_escape[LE_Q_ESCAPE_SIZE];         // escape limit for each k, see le_model_set_escape()
+    bool custom_escape;                         // q_escape isn't q_escape_for_k, the decoding table can't be used
+    bool runs;          // zero-run mode enabled, see le_model_enable_runs()
+    bool in_run;        // run state, kept across calls and sessions like k
+    uint8_t run_index;  // adaptive run segment length
+    uint8_t zero_count; // consecutive zero indices at k = 0
+#ifdef LE_RANGE_CODER
+    uint16_t probabilities[LE_ALPHABET_SIZE];   // range coder backend, binary tree over the 8-bit value
+#endif
+#ifdef LE_FREQUENCY_RANKING
+    uint16_t counts[LE_ALPHABET_SIZE];          // le_promote_frequency policy, indexed by symbol
+#endif
+#ifdef LE_STATS
+    le_model_stats stats;
+#endif
 } le_model;
 
-// ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_refill(le_stream* s)
-{
-    // pull bytes into the reservoir until it's full enough for any standard read
-    while (s->bits_available <= 56 && s->position < s->size)
-    {
-        s->bit_reservoir |= ((uint64_t)s->buffer[s->position]) << s->bits_available;
-        s->bits_available += 8;
-        s->position++;
-    }
-}
+#ifdef LE_STATS
+    #define LE_STATS_VALUE(model, value, k) le_stats_value(&(model)->stats, value, k, (model)->q_escape[k])
+    #define LE_STATS_WIDE(model, value, k, bits) le_stats_wide(&(model)->stats, value, k, bits)
+    #define LE_STATS_K(model, old_k, new_k) le_stats_k(&(model)->stats, old_k, new_k)
+    #define LE_STATS_INDEX(model, index) ((model)->stats.index_histogram[index]++)
+    #define LE_STATS_PROMOTE(model, moves) ((model)->stats.promotions++, (model)->stats.promote_moves += (moves))
+    #define LE_STATS_RUN(model, symbols, bits) le_stats_run(&(model)->stats, symbols, bits)
+    #define LE_STATS_RANGE(model, k) ((model)->stats.values++, (model)->stats.range_values++, (model)->stats.k_histogram[k]++)
+#else
+    #define LE_STATS_VALUE(model, value, k) ((void)0)
+    #define LE_STATS_WIDE(model, value, k, bits) ((void)0)
+    #define LE_STATS_K(model, old_k, new_k) ((void)0)
+    #define LE_STATS_INDEX(model, index) ((void)0)
+    #define LE_STATS_PROMOTE(model, moves) ((void)0)
+    #define LE_STATS_RUN(model, symbols, bits) ((void)0)
+    #define LE_STATS_RANGE(model, k) ((void)0)
+#endif
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_flush(le_stream* s)
+static inline uint64_t le_load64(const uint8_t* ptr)
 {
-    while (s->bits_available >= 8)
-    {
-        if (s->position >= s->size)
-        {
-            s->status = LE_BUFFER_OVERRUN;
-            return;
-        }
-        s->buffer[s->position] = (uint8_t)(s->bit_reservoir & 0xFF);
-        s->bit_reservoir >>= 8;
-        s->bits_available -= 8;
-        s->position++;
-    }
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    value = __builtin_bswap64(value);
+#endif
+    return value;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_init(le_stream *s, void* buffer, size_t size)
+static inline void le_store64(uint8_t* ptr, uint64_t value)
 {
-    s->buffer = (uint8_t*)buffer;
-    s->size = size;
-    s->position = 0;
-    s->bit_reservoir = 0;
-    s->bits_available = 0;
-    s->mode = le_mode_idle;
-    s->status = LE_OK;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    value = __builtin_bswap64(value);
+#endif
+    memcpy(ptr, &value, sizeof(value));
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_begin_encode(le_stream* s)
+// replaces the consumed content of the buffer by the next chunk of the source
+static inline bool le_read_chunk(le_stream* s)
 {
+    if (s->read == NULL || s->eof)
+        return false;
+
+    s->offset += s->size;
     s->position = 0;
-    s->bit_reservoir = 0;
-    s->bits_available = 0;
-    s->mode = le_mode_encode;
-    s->status = LE_OK;
+    s->size = s->read(s->read_user_data, s->buffer, s->capacity);
+    s->eof = (s->size == 0);
+    return !s->eof;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline size_t le_end_encode(le_stream* s)
+static inline void le_refill(le_stream* s)
 {
-    if (s->status != LE_OK) 
-        return 0;
+    if (s->bits_available > 56)
+        return;
 
-    size_t bytes_to_write = (s->bits_available + 7) / 8;
-    if (s->position + bytes_to_write > s->size)
+    // fast path : load a whole word, keep only the complete bytes that fit
+    // the bits above bits_available are the next bytes of the stream, so OR-ing them again later is harmless.
+    // With a source the padding holds stale bytes, the next ones come from the source through the tail
+    size_t readable = s->size + ((s->read == NULL) ? s->padding : 0);
+    if (s->position + 8 <= readable)
     {
-        s->status = LE_BUFFER_OVERRUN;
-        return 0;
+        s->bit_reservoir |= le_load64(s->buffer + s->position) << s->bits_available;
+        s->position += (63 - s->bits_available) >> 3;
+        s->bits_available |= 56;
+        return;
     }
 
-    while (s->bits_available > 0)
+    // tail : pull bytes into the reservoir until it's full enough for any standard read
+    while (s->bits_available <= 56)
     {
-        s->buffer[s->position] = (uint8_t)(s->bit_reservoir & 0xFF);
-        s->bit_reservoir >>= 8;
+        if (s->position >= s->size && !le_read_chunk(s))
+        {
+            // padded buffer : past the end, feed zeros so the unchecked functions never run dry
+            // le_end_decode() will detect that the stream was overrun
+            if (s->padding > 0)
+            {
+                s->position += (63 - s->bits_available) >> 3;
+                s->bits_available |= 56;
+            }
+            break;
+        }
+
+        s->bit_reservoir |= ((uint64_t)s->buffer[s->position]) << s->bits_available;
+        s->bits_available += 8;
         s->position++;
-        
-        if (s->bits_available > 8)
-            s->bits_available -= 8;
-        else
-            s->bits_available = 0;
     }
-
-    s->mode = le_mode_idle;
-    return s->position;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_begin_decode(le_stream* s)
+// hands the content of the buffer to the sink and restarts at the beginning of the buffer
+static inline bool le_write_chunk(le_stream* s)
 {
+    // a zero-size buffer can't take a byte, even once the sink emptied it
+    if (s->write == NULL || s->size == 0)
+    {
+        s->status = LE_BUFFER_OVERRUN;
+        return false;
+    }
+
+    if (!s->write(s->write_user_data, s->buffer, s->position))
+    {
+        s->status = LE_IO_ERROR;
+        return false;
+    }
+
+    s->offset += s->position;
     s->position = 0;
-    s->bit_reservoir = 0;
-    s->bits_available = 0;
-    s->mode = le_mode_decode;
-    s->status = LE_OK;
-    le_refill(s);
+    return true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_end_decode(le_stream* s)
+static inline void le_flush(le_stream* s)
 {
-    s->mode = le_mode_idle;
+    // fast path : store the whole reservoir at once, the incomplete byte will be overwritten by the next flush
+    if (s->position + 8 <= s->size + s->padding)
+    {
+        uint32_t bytes = s->bits_available >> 3;
+        le_store64(s->buffer + s->position, s->bit_reservoir);
+        s->bit_reservoir = (bytes < 8) ? (s->bit_reservoir >> (bytes * 8)) : 0;
+        s->bits_available &= 7;
+        s->position += bytes;
+        return;
+    }
+
+    // tail : one byte at a time, checking the bounds
+    while (s->bits_available >= 8)
+    {
+        if (s->position >= s->size && !le_write_chunk(s))
+        {
+            // drop the pending bits, the stream is invalid anyway and the reservoir must not grow forever
+            s->bit_reservoir = 0;
+            s->bits_available = 0;
+            return;
+        }
+        s->buffer[s->position] = (uint8_t)(s->bit_reservoir & 0xFF);
+        s->bit_reservoir >>= 8;
+        s->bits_available -= 8;
+        s->position++;
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -269,180 +531,2836 @@ static inline uint8_t le_read_byte(le_stream* s)
 }
 
 
+#ifdef LE_RANGE_CODER
 // ----------------------------------------------------------------------------------------------------------------------------
-void le_model_init(le_model *model)
+// range coder backend (LZMA style) : adaptive binary probabilities on LE_RC_PROB_BITS bits, the 8-bit MTF index or value
+// is coded with a binary tree of 255 probabilities stored in the model. The bytes go through the bit reservoir, so the
+// buffer, sink and source work the same way as with the rice backend. Compiled with LE_RANGE_CODER defined only.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_rc_shift_low(le_stream* s)
 {
-    for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+    // the top byte is only known once the carry can't propagate anymore, 0xFF bytes wait in rc_pending
+    if ((uint32_t)s->rc_low < 0xFF000000U || (s->rc_low >> 32) != 0)
     {
-        model->alphabet[i] = i;
-        model->index[i] = i;
+        uint8_t carry = (uint8_t)(s->rc_low >> 32);
+        uint8_t byte = s->rc_cache;
+        do
+        {
+            le_write_byte(s, (uint8_t)(byte + carry));
+            byte = 0xFF;
+        } while (--s->rc_pending != 0);
+        s->rc_cache = (uint8_t)(s->rc_low >> 24);
     }
-
-    model->k = 2;
-    model->k_trend = 0;
+    s->rc_pending++;
+    s->rc_low = (s->rc_low & 0x00FFFFFFU) << 8;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void rice_encode(le_stream *s, uint32_t value, uint8_t k) 
+static inline void le_rc_begin_encode(le_stream* s)
 {
-    uint32_t q = value >> k;
-    uint32_t q_limit = q_escape_for_k[k];
-    uint32_t r = value & ((1U << k) - 1U);
-
-    // checks if raw value is cheaper
-    q = (q >= q_limit) ? q_limit : q;
-
-    // unary prefix: q ones followed by a zero
-    le_write_bits(s, (1ULL << q) - 1ULL, (uint8_t)(q + 1));
-
-    // remainder or rawbyte
-    if (q == q_limit)
-        le_write_byte(s, value);
-    else if (k > 0) 
-        le_write_bits(s, (uint8_t)r, k);
+    s->rc_low = 0;
+    s->rc_range = 0xFFFFFFFFU;
+    s->rc_cache = 0;
+    s->rc_pending = 1;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline uint8_t rice_decode(le_stream *s, uint8_t k) 
+static inline void le_rc_end_encode(le_stream* s)
 {
-    if (s->bits_available < 32) 
-        le_refill(s);
+    for (uint32_t i = 0; i < 5; ++i)
+        le_rc_shift_low(s);
+}
 
-    uint32_t q = le_ctz64(~s->bit_reservoir | (1ULL << 63));
-    uint32_t q_limit = q_escape_for_k[k];
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_rc_begin_decode(le_stream* s)
+{
+    s->rc_range = 0xFFFFFFFFU;
+    s->rc_code = 0;
+    for (uint32_t i = 0; i < 5; ++i)
+        s->rc_code = (s->rc_code << 8) | le_read_byte(s);
+}
 
-    if (q >= q_limit)
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_rc_encode_bit(le_stream* s, uint16_t* probability, uint32_t bit)
+{
+    uint32_t bound = (s->rc_range >> LE_RC_PROB_BITS) * *probability;
+    if (bit == 0)
     {
-        if (s->bits_available < (q_limit + 1)) 
-        {
-            s->status = LE_BUFFER_OVERRUN;
-            return 0;
-        }
-        s->bit_reservoir >>= (q_limit + 1);
-        s->bits_available -= (q_limit + 1);
-        return le_read_byte(s);
+        s->rc_range = bound;
+        *probability += ((1U << LE_RC_PROB_BITS) - *probability) >> LE_RC_MOVE_BITS;
     }
-
-    uint32_t total_bits = q + 1 + k;
-    if (s->bits_available < total_bits) 
+    else
     {
-        s->status = LE_BUFFER_OVERRUN;
-        return 0;
+        s->rc_low += bound;
+        s->rc_range -= bound;
+        *probability -= *probability >> LE_RC_MOVE_BITS;
     }
 
-    uint32_t val = s->bit_reservoir;
-    
-    s->bit_reservoir >>= total_bits;
-    s->bits_available -= total_bits;
-
-    uint32_t r = (val >> (q + 1)) & ((1U << k) - 1);
-    return (uint8_t)((q << k) | r);
+    while (s->rc_range < LE_RC_TOP)
+    {
+        s->rc_range <<= 8;
+        le_rc_shift_low(s);
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_model_update_k(le_model* model, uint8_t value)
+static inline uint32_t le_rc_decode_bit(le_stream* s, uint16_t* probability)
 {
-    if (value < (1U << model->k) && model->k > 0) 
-        model->k_trend--;
-    else if (value > (3U << model->k) && model->k < 7) 
-        model->k_trend++;
-
-    // soft adaptation
-    if (model->k_trend > LE_K_TREND_THRESHOLD)
+    uint32_t bound = (s->rc_range >> LE_RC_PROB_BITS) * *probability;
+    uint32_t bit;
+    if (s->rc_code < bound)
+    {
+        s->rc_range = bound;
+        *probability += ((1U << LE_RC_PROB_BITS) - *probability) >> LE_RC_MOVE_BITS;
+        bit = 0;
+    }
+    else
     {
-        model->k++;
-        model->k_trend = 0;
+        s->rc_code -= bound;
+        s->rc_range -= bound;
+        *probability -= *probability >> LE_RC_MOVE_BITS;
+        bit = 1;
     }
-    else if (model->k_trend < -LE_K_TREND_THRESHOLD)
+
+    while (s->rc_range < LE_RC_TOP)
     {
-        model->k--;
-        model->k_trend = 0;
+        s->rc_range <<= 8;
+        s->rc_code = (s->rc_code << 8) | le_read_byte(s);
     }
+    return bit;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_model_promote(le_model* model, uint32_t index)
+// most significant bit first, the node of each bit is its prefix with a leading one : probabilities[1..255]
+static inline void le_rc_encode_tree(le_stream* s, uint16_t* probabilities, uint32_t value)
 {
-    if (index == 0 || model->k >= 6)
-        return;
-
-    uint32_t target = index / 2;
-    uint8_t value = model->alphabet[index];
-
-    for (uint32_t i = index; i > target; --i)
+    uint32_t node = 1;
+    for (int32_t i = 7; i >= 0; --i)
     {
-        uint8_t v = model->alphabet[i - 1];
-        model->alphabet[i] = v;
-        model->index[v] = (uint8_t)i;
+        uint32_t bit = (value >> i) & 1;
+        le_rc_encode_bit(s, &probabilities[node], bit);
+        node = (node << 1) | bit;
     }
-
-    model->alphabet[target] = value;
-    model->index[value] = (uint8_t)target;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_encode_symbol(le_stream *s, le_model *model, uint8_t value)
+static inline uint8_t le_rc_decode_tree(le_stream* s, uint16_t* probabilities)
 {
-    uint32_t index = model->index[value];
-
-    rice_encode(s, index, model->k);
-    le_model_promote(model, index);
-    le_model_update_k(model, (uint8_t)index);
+    uint32_t node = 1;
+    for (uint32_t i = 0; i < 8; ++i)
+        node = (node << 1) | le_rc_decode_bit(s, &probabilities[node]);
+    return (uint8_t)node;
 }
+#endif
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline uint8_t le_decode_symbol(le_stream *restrict s, le_model *restrict model) 
+static inline void le_init(le_stream *s, void* buffer, size_t size)
 {
-    uint8_t index = rice_decode(s, model->k);
-    uint8_t value = model->alphabet[index];
-
-    le_model_promote(model, index);
-    le_model_update_k(model, index);
+    s->buffer = (uint8_t*)buffer;
+    s->size = size;
+    s->capacity = size;
+    s->padding = 0;
+    s->write = NULL;
+    s->read = NULL;
+    s->write_user_data = NULL;
+    s->read_user_data = NULL;
+    s->offset = 0;
+    s->eof = false;
+    s->position = 0;
+    s->bit_reservoir = 0;
+    s->bits_available = 0;
+    s->backend = le_backend_rice;
+    s->mode = le_mode_idle;
+    s->status = LE_OK;
+}
 
-    return value;
+// ----------------------------------------------------------------------------------------------------------------------------
+// same as le_init() but the caller guarantees that LE_PADDING bytes are allocated after buffer[size-1]
+// the encoder can then always flush a whole word, the padding bytes content is undefined after encoding
+// the decoder can always load a whole word and the *_unchecked() decoding functions can be used
+static inline void le_init_padded(le_stream *s, void* buffer, size_t size)
+{
+    le_init(s, buffer, size);
+    s->padding = LE_PADDING;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline uint8_t zigzag8_encode(int8_t v)
+// when the buffer is full, its content is given to the write function and the encoding continues
+// at the beginning of the buffer : the output size is not limited by the size of the buffer anymore.
+// The buffer must hold at least one byte, the encoding fails with LE_BUFFER_OVERRUN otherwise
+static inline void le_set_sink(le_stream *s, le_write_func write, void* user_data)
 {
-    return (uint8_t)(((uint8_t)v << 1) ^ (v >> 7));
+    s->write = write;
+    s->write_user_data = user_data;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline int8_t zigzag8_decode(uint8_t v)
+// the decoder doesn't expect the whole stream in the buffer : each time the buffer is consumed, 
+// the read function is called to get the next chunk
+static inline void le_set_source(le_stream *s, le_read_func read, void* user_data)
 {
-    return (int8_t)((v >> 1) ^ -(int8_t)(v & 1));
+    s->read = read;
+    s->read_user_data = user_data;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_encode_literal(le_stream *s, le_model* model, uint8_t value)
+// selects the entropy coder, before le_begin_encode()/le_begin_decode(). The range coder compresses skewed distributions
+// better at a higher CPU cost. The wide values and the context model are rice only, the zero-run mode is ignored.
+static inline void le_set_backend(le_stream *s, le_backend backend)
 {
-    rice_encode(s, value, model->k);
-    le_model_update_k(model, value);
+    s->backend = backend;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline uint8_t le_decode_literal(le_stream* s, le_model* model)
+// guards the rice only functions : a range coder stream fails with LE_UNSUPPORTED_BACKEND instead of mixing raw bits
+// with the pending bytes of the range coder
+static inline bool le_require_rice(le_stream* s)
 {
-    uint8_t value = rice_decode(s, model->k);
-    le_model_update_k(model, value);
-    return value;
+    if (s->backend == le_backend_rice)
+        return true;
+
+    s->status = LE_UNSUPPORTED_BACKEND;
+    return false;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline void le_encode_delta(le_stream *s, le_model* model, int8_t delta)
+static inline void le_begin_encode(le_stream* s)
 {
-    uint8_t zz = zigzag8_encode(delta);
-    rice_encode(s, zz, model->k);
-    le_model_update_k(model, zz);
+    s->size = s->capacity;
+    s->offset = 0;
+    s->position = 0;
+    s->bit_reservoir = 0;
+    s->bits_available = 0;
+    s->mode = le_mode_encode;
+    s->status = LE_OK;
+
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+        le_rc_begin_encode(s);
+#endif
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-static inline int8_t le_decode_delta(le_stream* s, le_model* model)
+static inline size_t le_end_encode(le_stream* s)
 {
-    uint8_t zz = rice_decode(s, model->k);
-    le_model_update_k(model, zz);
-    return zigzag8_decode(zz);
+    if (s->status != LE_OK) 
+        return 0;
+
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+        le_rc_end_encode(s);
+#endif
+
+    // the last byte is padded with zeros
+    s->bits_available = (s->bits_available + 7) & ~7U;
+    le_flush(s);
+
+    if (s->status == LE_OK && s->write != NULL && s->position > 0)
+        le_write_chunk(s);
+
+    if (s->status != LE_OK)
+        return 0;
+
+    // with a padded buffer the fast path can go past the end without noticing
+    if (s->position > s->size)
+    {
+        s->status = LE_BUFFER_OVERRUN;
+        return 0;
+    }
+
+    s->mode = le_mode_idle;
+    return s->offset + s->position;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_begin_decode(le_stream* s)
+{
+    // with a source, the buffer content is unknown until the first chunk is read
+    if (s->read != NULL)
+        s->size = 0;
+
+    s->offset = 0;
+    s->eof = false;
+    s->position = 0;
+    s->bit_reservoir = 0;
+    s->bits_available = 0;
+    s->mode = le_mode_decode;
+    s->status = LE_OK;
+    le_refill(s);
+
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+        le_rc_begin_decode(s);
+#endif
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_end_decode(le_stream* s)
+{
+    // catches the overrun of the unchecked functions : more bytes consumed than the buffer contains, or more bits
+    // consumed than the reservoir held (bits_available wraps)
+    if (s->bits_available > 64 || s->position * 8 > s->size * 8 + s->bits_available)
+        s->status = LE_BUFFER_OVERRUN;
+
+    s->mode = le_mode_idle;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void le_model_init(le_model *model)
+{
+    for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+    {
+        model->alphabet[i] = i;
+        model->index[i] = i;
+    }
+
+    model->k_params = le_default_k_params;
+    model->k = model->k_params.initial_k;
+    model->k_trend = 0;
+    model->k_fast_trend = 0;
+    memcpy(model->q_escape, q_escape_for_k, sizeof(model->q_escape));
+    model->custom_escape = false;
+    model->runs = false;
+    model->in_run = false;
+    model->run_index = 0;
+    model->zero_count = 0;
+
+#ifdef LE_RANGE_CODER
+    for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+        model->probabilities[i] = 1U << (LE_RC_PROB_BITS - 1);
+#endif
+
+#ifdef LE_FREQUENCY_RANKING
+    memset(model->counts, 0, sizeof(model->counts));
+#endif
+
+#ifdef LE_STATS
+    memset(&model->stats, 0, sizeof(model->stats));
+#endif
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// the trends are int8_t, the thresholds must leave room for one more signal. The bands can't overlap.
+static inline bool le_k_params_valid(const le_k_params* params)
+{
+    return params->initial_k < LE_Q_ESCAPE_SIZE && params->threshold <= 126 && params->fast_threshold <= 126 &&
+           params->low <= params->high;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// same as le_model_init() with other soft-K parameters, encoder and decoder must use the same ones.
+// Returns false (and leaves a model with the default parameters) if the parameters are invalid.
+static inline bool le_model_init_params(le_model *model, const le_k_params* params)
+{
+    le_model_init(model);
+    if (!le_k_params_valid(params))
+        return false;
+
+    model->k_params = *params;
+    model->k = params->initial_k;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// longest codeword of an 8-bit value at k with the escape limit q_limit
+static inline uint32_t le_max_code_bits(uint32_t k, uint32_t q_limit)
+{
+    uint32_t q_max = 255 >> k;
+    return (q_limit <= q_max) ? q_limit + 1 + 8 : q_max + 1 + k;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// longest codeword of the 8-bit values with the escape limits of the model
+static inline uint32_t le_model_max_code_bits(const le_model* model)
+{
+    uint32_t max_bits = 0;
+    for (uint32_t k = 0; k < LE_Q_ESCAPE_SIZE; ++k)
+    {
+        uint32_t bits = le_max_code_bits(k, model->q_escape[k]);
+        max_bits = (bits > max_bits) ? bits : max_bits;
+    }
+    return max_bits;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// same as LE_MAX_ENCODED_SIZE() with the escape limits and the run state of the model, tighter with q_escape_tight
+// (8-bit values only)
+static inline size_t le_model_max_encoded_size(const le_model* model, size_t count, le_backend backend)
+{
+#ifdef LE_RANGE_CODER
+    if (backend == le_backend_range)
+        return LE_MAX_ENCODED_SIZE_RANGE(count);
+#else
+    (void)backend;
+#endif
+    size_t run_break = (model->runs && model->in_run && count > 0) ? 1 + run_bits_for_index[model->run_index] : 0;
+    return (count * le_model_max_code_bits(model) + run_break + 7) / 8;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// replaces the escape limits of the 8-bit values (q_escape_for_k by default), q_escape_tight or a smaller limit escapes
+// the outliers earlier and shortens the longest codeword. Returns false and leaves the model unchanged if a codeword
+// could exceed LE_MAX_CODE_BITS. Encoder and decoder must use the same limits.
+static inline bool le_model_set_escape(le_model* model, const uint8_t q_escape[LE_Q_ESCAPE_SIZE])
+{
+    for (uint32_t k = 0; k < LE_Q_ESCAPE_SIZE; ++k)
+    {
+        if (le_max_code_bits(k, q_escape[k]) > LE_MAX_CODE_BITS)
+            return false;
+    }
+
+    memcpy(model->q_escape, q_escape, sizeof(model->q_escape));
+    model->custom_escape = (memcmp(q_escape, q_escape_for_k, sizeof(q_escape_for_k)) != 0);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// long runs of the same symbol cost less than a bit per symbol, only used by le_encode_symbols() and le_decode_symbols()
+// both sides must enable it. The run state (in a run, segment length, zero count) is part of the model like k : it carries
+// over to the next call and the next session, le_model_init() or le_model_load() starts from a fresh state
+static inline void le_model_enable_runs(le_model* model)
+{
+    model->runs = true;
+}
+
+#ifdef LE_STATS
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_model_stats_reset(le_model* model)
+{
+    memset(&model->stats, 0, sizeof(model->stats));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_model_stats_dump(const le_model* model, FILE* file)
+{
+    const le_model_stats* stats = &model->stats;
+    double values = (stats->values > 0) ? (double)stats->values : 1.0;
+
+    // the range coder has no codewords, its values are reported apart
+    double rice_values = (stats->values > stats->range_values) ? (double)(stats->values - stats->range_values) : 1.0;
+    fprintf(file, "values : %llu, bits : %llu (%.3f bits/value), escapes : %llu (%.2f%%)\n", (unsigned long long)stats->values,
+            (unsigned long long)stats->bits, (double)stats->bits / rice_values, (unsigned long long)stats->escapes,
+            100.0 * (double)stats->escapes / rice_values);
+    if (stats->range_values > 0)
+        fprintf(file, "range coded : %llu values, not counted in bits and escapes\n", (unsigned long long)stats->range_values);
+
+    // the wide values can use k up to 31, only show the range actually used
+    uint32_t k_count = 32;
+    while (k_count > 8 && stats->k_histogram[k_count - 1] == 0)
+        k_count--;
+
+    fprintf(file, "k histogram :");
+    for (uint32_t k = 0; k < k_count; ++k)
+        fprintf(file, " [%u] %.2f%%", k, 100.0 * (double)stats->k_histogram[k] / values);
+    fprintf(file, "\nk transitions : %llu up, %llu down\n", (unsigned long long)stats->k_increases, (unsigned long long)stats->k_decreases);
+
+    // MTF index distance by power of two buckets
+    uint64_t symbols = 0;
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; ++i)
+        symbols += stats->index_histogram[i];
+
+    if (symbols > 0)
+    {
+        fprintf(file, "mtf index :");
+        for (uint32_t first = 0; first < LE_ALPHABET_SIZE; first = (first == 0) ? 1 : first * 2)
+        {
+            uint32_t last = (first == 0) ? 0 : first * 2 - 1;
+            uint64_t count = 0;
+            for (uint32_t i = first; i <= last; ++i)
+                count += stats->index_histogram[i];
+            fprintf(file, " [%u-%u] %.2f%%", first, last, 100.0 * (double)count / (double)symbols);
+        }
+        fprintf(file, "\npromotions : %llu, %.2f moves/symbol\n", (unsigned long long)stats->promotions, (double)stats->promote_moves / (double)symbols);
+        if (stats->run_symbols > 0)
+            fprintf(file, "run mode : %.2f%% of the symbols\n", 100.0 * (double)stats->run_symbols / (double)symbols);
+    }
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// q_limit is the escape limit of k, from the model (or q_escape_for_k)
+static inline void rice_encode(le_stream *s, uint32_t value, uint8_t k, uint32_t q_limit)
+{
+    uint32_t q = value >> k;
+
+    // checks if raw value is cheaper : the unary prefix is then followed by the raw byte instead of the remainder
+    bool escape = (q >= q_limit);
+    q = escape ? q_limit : q;
+    uint32_t payload_bits = escape ? 8 : k;
+    uint64_t payload = value & ((1U << payload_bits) - 1U);
+
+    // unary prefix (q ones followed by a zero) and payload in a single write, LE_MAX_CODE_BITS at most
+    le_write_bits(s, ((1ULL << q) - 1ULL) | (payload << (q + 1)), (uint8_t)(q + 1 + payload_bits));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t rice_decode(le_stream *s, uint8_t k, uint32_t q_limit)
+{
+    if (s->bits_available < 32) 
+        le_refill(s);
+
+    uint32_t q = le_ctz64(~s->bit_reservoir | (1ULL << 63));
+
+    if (q >= q_limit)
+    {
+        if (s->bits_available < (q_limit + 1)) 
+        {
+            s->status = LE_BUFFER_OVERRUN;
+            return 0;
+        }
+        s->bit_reservoir >>= (q_limit + 1);
+        s->bits_available -= (q_limit + 1);
+        return le_read_byte(s);
+    }
+
+    uint32_t total_bits = q + 1 + k;
+    if (s->bits_available < total_bits) 
+    {
+        s->status = LE_BUFFER_OVERRUN;
+        return 0;
+    }
+
+    uint32_t val = s->bit_reservoir;
+    
+    s->bit_reservoir >>= total_bits;
+    s->bits_available -= total_bits;
+
+    uint32_t r = (val >> (q + 1)) & ((1U << k) - 1);
+    return (uint8_t)((q << k) | r);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// no bounds check : the stream must be initialized with le_init_padded(), validity is checked by le_end_decode()
+static inline uint8_t rice_decode_unchecked(le_stream *s, uint8_t k, uint32_t q_limit)
+{
+    if (s->bits_available < 32)
+        le_refill(s);
+
+    uint32_t q = le_ctz64(~s->bit_reservoir | (1ULL << 63));
+    bool escape = (q >= q_limit);
+
+    // escape is the unary prefix followed by a raw byte. A valid code has q <= 255 >> k, garbage (ones read past the
+    // end) is clamped so a codeword never exceeds LE_MAX_CODE_BITS and the shift stays defined
+    uint32_t q_max = 255U >> k;
+    q = escape ? q_limit : (q < q_max ? q : q_max);
+    uint32_t payload_bits = escape ? 8 : k;
+    uint32_t payload = (uint32_t)(s->bit_reservoir >> (q + 1)) & ((1U << payload_bits) - 1U);
+    uint32_t total_bits = q + 1 + payload_bits;
+
+    s->bit_reservoir >>= total_bits;
+    s->bits_available -= total_bits;
+
+    return (uint8_t)(escape ? payload : ((q << k) | payload));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// multi-symbols decoding table for small k, indexed by [k][next LE_TABLE_BITS bits of the reservoir]
+// each entry contains the number of complete codes in the window (3 bits), their total length (4 bits) 
+// followed by the decoded values (6 bits each)
+// escape codes are never in the table, an entry without values means the slow path has to be used
+// built with q_escape_for_k, models with their own escape limits don't use it
+// the table is built on first use by one thread and published with a release store, returns NULL while another thread
+// builds it : the caller decodes with the slow path meanwhile
+static inline const uint32_t* le_decode_table(void)
+{
+    static uint32_t table[(LE_TABLE_MAX_K + 1) << LE_TABLE_BITS];
+    static volatile long state = 0;    // 0 : empty, 1 : being built, 2 : ready
+
+    if (le_atomic_load(&state) == 2)
+        return table;
+
+    if (!le_atomic_cas(&state, 0, 1))
+        return (le_atomic_load(&state) == 2) ? table : NULL;
+
+    for (uint32_t k = 0; k <= LE_TABLE_MAX_K; ++k)
+    {
+        for (uint32_t bits = 0; bits < (1U << LE_TABLE_BITS); ++bits)
+        {
+            uint32_t entry = 0, position = 0, count = 0;
+            while (count < LE_TABLE_MAX_VALUES)
+            {
+                uint32_t q = le_ctz64(~((uint64_t)bits >> position));
+                if (q >= q_escape_for_k[k] || position + q + 1 + k > LE_TABLE_BITS)
+                    break;
+
+                uint32_t r = (bits >> (position + q + 1)) & ((1U << k) - 1U);
+                entry |= ((q << k) | r) << (7 + count * 6);
+                position += q + 1 + k;
+                count++;
+            }
+            table[(k << LE_TABLE_BITS) | bits] = entry | (position << 3) | count;
+        }
+    }
+
+    le_atomic_store(&state, 2);
+    return table;
+}
+
+#ifdef LE_STATS
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_stats_code(le_model_stats* stats, uint32_t value, uint32_t k, uint32_t q_limit, uint32_t raw_bits)
+{
+    uint32_t q = value >> k;
+
+    stats->values++;
+    stats->k_histogram[k]++;
+    if (q >= q_limit)
+    {
+        stats->escapes++;
+        stats->bits += q_limit + 1 + raw_bits;
+    }
+    else
+        stats->bits += q + 1 + k;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_stats_value(le_model_stats* stats, uint32_t value, uint32_t k, uint32_t q_limit)
+{
+    le_stats_code(stats, value, k, q_limit, 8);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_stats_wide(le_model_stats* stats, uint32_t value, uint32_t k, uint32_t bits)
+{
+    le_stats_code(stats, value, k, (bits == 16) ? q_escape_for_k16[k] : q_escape_for_k32[k], bits);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_stats_k(le_model_stats* stats, uint32_t old_k, uint32_t new_k)
+{
+    stats->k_increases += (new_k > old_k);
+    stats->k_decreases += (new_k < old_k);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_stats_run(le_model_stats* stats, size_t symbols, uint32_t bits)
+{
+    stats->values += symbols;
+    stats->bits += bits;
+    stats->k_histogram[0] += symbols;
+    stats->index_histogram[0] += symbols;
+    stats->run_symbols += symbols;
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// soft-K adaptation on a local copy of k and the trends, so the bulk functions can keep them in registers
+// max_k is 7 for the byte values, 15 and 31 for the wide values
+static inline void le_adapt_k(uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend, uint32_t value, uint32_t max_k,
+                              const le_k_params* params)
+{
+    int8_t step = 0;
+    if (value < ((uint64_t)params->low << *k) && *k > 0)
+        step = -1;
+    else if (value > ((uint64_t)params->high << *k) && *k < max_k)
+        step = 1;
+
+    *k_trend += step;
+
+    // dual-rate : the fast trend only counts consecutive signals, a neutral or opposite value restarts it
+    bool fast = (params->fast_threshold > 0);
+    if (fast)
+        *k_fast_trend = (step != 0 && (*k_fast_trend ^ step) >= 0) ? (int8_t)(*k_fast_trend + step) : step;
+
+    // soft adaptation
+    if (*k_trend > params->threshold || (fast && *k_fast_trend > params->fast_threshold))
+    {
+        (*k)++;
+        *k_trend = 0;
+        *k_fast_trend = 0;
+    }
+    else if (*k_trend < -params->threshold || (fast && *k_fast_trend < -params->fast_threshold))
+    {
+        (*k)--;
+        *k_trend = 0;
+        *k_fast_trend = 0;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// default parameters, without dual-rate
+static inline void le_update_k(uint8_t* k, int8_t* k_trend, uint32_t value)
+{
+    int8_t k_fast_trend = 0;
+    le_adapt_k(k, k_trend, &k_fast_trend, value, 7, &le_default_k_params);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// called once per coded value, after le_entropy_encode()/le_entropy_decode() which gather the value statistics
+static inline void le_model_update_k(le_model* model, uint8_t value)
+{
+#ifdef LE_STATS
+    uint8_t old_k = model->k;
+#endif
+
+    le_adapt_k(&model->k, &model->k_trend, &model->k_fast_trend, value, 7, &model->k_params);
+    LE_STATS_K(model, old_k, model->k);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// adds one to every entry of the index table in [first, first + count[ (count > 0), the cost doesn't depend on count.
+// One function per instruction set so the test can check each one against the scalar loop.
+static inline void le_index_increment_scalar(uint8_t* index, uint32_t first, uint32_t count)
+{
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; ++i)
+        index[i] += (uint8_t)((uint8_t)(index[i] - first) < count);
+}
+
+#if defined(LE_AVX2)
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_index_increment_avx2(uint8_t* index, uint32_t first, uint32_t count)
+{
+    const __m256i v_first = _mm256_set1_epi8((char)first);
+    const __m256i v_last = _mm256_set1_epi8((char)(count - 1));
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(index + i));
+        __m256i offset = _mm256_sub_epi8(v, v_first);
+        __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, v_last), offset);
+        _mm256_storeu_si256((__m256i*)(index + i), _mm256_sub_epi8(v, in_range));
+    }
+}
+#endif
+
+#if defined(LE_SSE2)
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_index_increment_sse2(uint8_t* index, uint32_t first, uint32_t count)
+{
+    const __m128i v_first = _mm_set1_epi8((char)first);
+    const __m128i v_last = _mm_set1_epi8((char)(count - 1));
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(index + i));
+        __m128i offset = _mm_sub_epi8(v, v_first);
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, v_last), offset);
+        _mm_storeu_si128((__m128i*)(index + i), _mm_sub_epi8(v, in_range));
+    }
+}
+#endif
+
+#if defined(LE_NEON)
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_index_increment_neon(uint8_t* index, uint32_t first, uint32_t count)
+{
+    const uint8x16_t v_first = vdupq_n_u8((uint8_t)first);
+    const uint8x16_t v_last = vdupq_n_u8((uint8_t)(count - 1));
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(index + i);
+        uint8x16_t in_range = vcleq_u8(vsubq_u8(v, v_first), v_last);
+        vst1q_u8(index + i, vsubq_u8(v, in_range));
+    }
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_index_increment(uint8_t* index, uint32_t first, uint32_t count)
+{
+#if defined(LE_AVX2)
+    le_index_increment_avx2(index, first, count);
+#elif defined(LE_SSE2)
+    le_index_increment_sse2(index, first, count);
+#elif defined(LE_NEON)
+    le_index_increment_neon(index, first, count);
+#else
+    le_index_increment_scalar(index, first, count);
+#endif
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// moves the symbol at index to target (< index), the symbols in between shift one position back
+static inline void le_move(le_model* model, uint32_t index, uint32_t target)
+{
+    uint8_t value = model->alphabet[index];
+    LE_STATS_PROMOTE(model, index - target);
+
+    // long moves : shift the alphabet slice at once and update the index table without scattered writes
+    if (index - target >= LE_PROMOTE_SIMD_MIN)
+    {
+        le_index_increment(model->index, target, index - target);
+        memmove(model->alphabet + target + 1, model->alphabet + target, index - target);
+        model->alphabet[target] = value;
+        model->index[value] = (uint8_t)target;
+        return;
+    }
+
+    for (uint32_t i = index; i > target; --i)
+    {
+        uint8_t v = model->alphabet[i - 1];
+        model->alphabet[i] = v;
+        model->index[v] = (uint8_t)i;
+    }
+
+    model->alphabet[target] = value;
+    model->index[value] = (uint8_t)target;
+}
+
+#ifdef LE_FREQUENCY_RANKING
+// ----------------------------------------------------------------------------------------------------------------------------
+// counts the symbol and moves it before the symbols with a lower count, counts are halved before they overflow
+static inline void le_rank_by_frequency(le_model* model, uint32_t index)
+{
+    uint8_t value = model->alphabet[index];
+    if (model->counts[value] == UINT16_MAX)
+    {
+        for (uint32_t i = 0; i < LE_ALPHABET_SIZE; ++i)
+            model->counts[i] >>= 1;
+    }
+
+    uint32_t count = ++model->counts[value];
+    uint32_t target = index;
+    while (target > 0 && model->counts[model->alphabet[target - 1]] < count)
+        target--;
+
+    if (target < index)
+        le_move(model, index, target);
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_promote_ex(le_model* model, uint32_t index, uint32_t k, const le_promote_policy policy)
+{
+#ifdef LE_FREQUENCY_RANKING
+    if (policy == le_promote_frequency)
+    {
+        le_rank_by_frequency(model, index);
+        return;
+    }
+#endif
+
+    if (index == 0 || (policy == le_promote_half && k >= 6))
+        return;
+
+    switch (policy)
+    {
+    case le_promote_front : le_move(model, index, 0); break;
+    case le_promote_quarter : le_move(model, index, index / 4); break;
+    case le_promote_step : le_move(model, index, index - 1); break;
+    default : le_move(model, index, index / 2); break;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_promote(le_model* model, uint32_t index, uint32_t k)
+{
+    le_promote_ex(model, index, k, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_model_promote(le_model* model, uint32_t index)
+{
+    le_promote(model, index, model->k);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// codes an 8-bit MTF index or value with the backend of the stream
+static inline void le_entropy_encode(le_stream* s, le_model* model, uint32_t value)
+{
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+    {
+        le_rc_encode_tree(s, model->probabilities, value);
+        LE_STATS_RANGE(model, model->k);
+        return;
+    }
+#endif
+    rice_encode(s, value, model->k, model->q_escape[model->k]);
+    LE_STATS_VALUE(model, value, model->k);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_entropy_decode(le_stream* s, le_model* model)
+{
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+    {
+        LE_STATS_RANGE(model, model->k);
+        return le_rc_decode_tree(s, model->probabilities);
+    }
+#endif
+    uint8_t value = rice_decode(s, model->k, model->q_escape[model->k]);
+    LE_STATS_VALUE(model, value, model->k);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_entropy_decode_unchecked(le_stream* s, le_model* model)
+{
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+    {
+        LE_STATS_RANGE(model, model->k);
+        return le_rc_decode_tree(s, model->probabilities);
+    }
+#endif
+    uint8_t value = rice_decode_unchecked(s, model->k, model->q_escape[model->k]);
+    LE_STATS_VALUE(model, value, model->k);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// the *_ex() functions take the promotion policy, it must be a constant so it is resolved at compile time
+static LE_FORCE_INLINE void le_encode_symbol_ex(le_stream *s, le_model *model, uint8_t value, const le_promote_policy policy)
+{
+    uint32_t index = model->index[value];
+
+    le_entropy_encode(s, model, index);
+    LE_STATS_INDEX(model, index);
+    le_promote_ex(model, index, model->k, policy);
+    le_model_update_k(model, (uint8_t)index);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE uint8_t le_decode_symbol_ex(le_stream *restrict s, le_model *restrict model, const le_promote_policy policy)
+{
+    uint8_t index = le_entropy_decode(s, model);
+    uint8_t value = model->alphabet[index];
+
+    LE_STATS_INDEX(model, index);
+    le_promote_ex(model, index, model->k, policy);
+    le_model_update_k(model, index);
+
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE uint8_t le_decode_symbol_unchecked_ex(le_stream *restrict s, le_model *restrict model, const le_promote_policy policy)
+{
+    uint8_t index = le_entropy_decode_unchecked(s, model);
+    uint8_t value = model->alphabet[index];
+
+    LE_STATS_INDEX(model, index);
+    le_promote_ex(model, index, model->k, policy);
+    le_model_update_k(model, index);
+
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_symbol(le_stream *s, le_model *model, uint8_t value)
+{
+    le_encode_symbol_ex(s, model, value, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_decode_symbol(le_stream *restrict s, le_model *restrict model) 
+{
+    return le_decode_symbol_ex(s, model, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_decode_symbol_unchecked(le_stream *restrict s, le_model *restrict model) 
+{
+    return le_decode_symbol_unchecked_ex(s, model, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// bulk functions : same output as calling the single value functions count times, but the stream state, k and k_trend
+// stay in local variables for the whole loop. They stop at the first error, check the status of the stream.
+// Each bulk function dispatches to a kernel compiled for a constant k (shifts, masks and escape become immediates)
+// and only switches kernel when the soft-K adaptation changes k.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// encodes symbols while k == K, returns the position of the first symbol not encoded
+static LE_FORCE_INLINE size_t le_encode_symbols_kernel(le_stream *restrict s, le_model *restrict model, uint8_t* k, int8_t* k_trend,
+                                                       int8_t* k_fast_trend, const le_k_params* params, const uint8_t* input,
+                                                       size_t i, size_t count, const uint32_t K, const le_promote_policy policy)
+{
+    const uint32_t q_limit = model->q_escape[K];
+    while (i < count && *k == K && s->status == LE_OK)
+    {
+        uint32_t index = model->index[input[i++]];
+
+        rice_encode(s, index, K, q_limit);
+        LE_STATS_VALUE(model, index, K);
+        LE_STATS_INDEX(model, index);
+        le_promote_ex(model, index, K, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+        LE_STATS_K(model, K, *k);
+    }
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// zero-run mode (opt-in, see le_model_enable_runs()), replaces the k = 0 kernel in the bulk symbol functions
+// after LE_RUN_THRESHOLD consecutive zero indices, runs of index 0 are coded by segments of 2^J zeros (J from run_bits_for_index) :
+// a complete segment writes a '1', a shorter run ended by another symbol writes a '0', the run length on J bits and the
+// index of the symbol minus one. The run still pending at the end of the call is closed as a complete segment, the decoder
+// drops the extra zeros, so runs never span two calls : decoding calls must use the same counts as the encoding calls.
+// The model stays in run mode though (in_run and run_index carry over), the next call or session starts in a run and
+// its first symbol can pay the run break, see LE_MAX_RUN_BREAK_BITS.
+static LE_FORCE_INLINE size_t le_encode_symbols_runs(le_stream *restrict s, le_model *restrict model, uint8_t* k, int8_t* k_trend,
+                                                     int8_t* k_fast_trend, const le_k_params* params, const uint8_t* input,
+                                                     size_t i, size_t count, const le_promote_policy policy)
+{
+    const uint32_t q_limit = model->q_escape[0];
+    while (i < count && *k == 0 && s->status == LE_OK)
+    {
+        if (!model->in_run)
+        {
+            uint32_t index = model->index[input[i++]];
+
+            rice_encode(s, index, 0, q_limit);
+            LE_STATS_VALUE(model, index, 0);
+            LE_STATS_INDEX(model, index);
+            le_promote_ex(model, index, 0, policy);
+            le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+            LE_STATS_K(model, 0, *k);
+
+            model->zero_count = (index == 0 && model->zero_count < LE_RUN_THRESHOLD) ? model->zero_count + 1 : 0;
+            model->in_run = (model->zero_count == LE_RUN_THRESHOLD);
+            continue;
+        }
+
+        uint32_t bits = run_bits_for_index[model->run_index];
+        size_t segment = (size_t)1 << bits;
+        size_t run = 0;
+        uint8_t zero = model->alphabet[0];
+
+        while (run < segment && i + run < count && input[i + run] == zero)
+            run++;
+        i += run;
+
+        if (run == segment || i == count)
+        {
+            le_write_bits(s, 1, 1);
+            LE_STATS_RUN(model, run, 1);
+            model->run_index += (model->run_index < LE_RUN_INDEX_MAX);
+            continue;
+        }
+
+        uint32_t index = model->index[input[i++]];
+        le_write_bits(s, (uint64_t)run << 1, (uint8_t)(1 + bits));
+        LE_STATS_RUN(model, run, 1 + bits);
+        model->run_index -= (model->run_index > 0);
+
+        rice_encode(s, index - 1, 0, q_limit);
+        LE_STATS_VALUE(model, index - 1, 0);
+        LE_STATS_INDEX(model, index);
+        le_promote_ex(model, index, 0, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+        LE_STATS_K(model, 0, *k);
+
+        model->in_run = false;
+        model->zero_count = 0;
+    }
+
+    if (*k != 0)
+        model->zero_count = 0;
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_encode_symbols_ex(le_stream *restrict s, le_model *restrict model, const uint8_t* input, size_t count,
+                                                 const le_promote_policy policy)
+{
+#ifdef LE_RANGE_CODER
+    // the kernels are rice only
+    if (s->backend == le_backend_range)
+    {
+        for (size_t i = 0; i < count && s->status == LE_OK; ++i)
+            le_encode_symbol_ex(s, model, input[i], policy);
+        return;
+    }
+#endif
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    size_t i = 0;
+
+    while (i < count && stream.status == LE_OK)
+    {
+        if (model->runs && k == 0)
+        {
+            i = le_encode_symbols_runs(&stream, model, &k, &k_trend, &k_fast_trend, &params, input, i, count, policy);
+            continue;
+        }
+
+#define LE_RUN(K) i = le_encode_symbols_kernel(&stream, model, &k, &k_trend, &k_fast_trend, &params, input, i, count, K, policy)
+        LE_SWITCH_K(k, LE_RUN, stream.status = LE_INVALID_MODEL)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// decodes symbols while k == K, returns the position of the first symbol not decoded
+// for small K, up to LE_TABLE_MAX_VALUES symbols are decoded with a single table lookup
+static LE_FORCE_INLINE size_t le_decode_symbols_kernel(le_stream *restrict s, le_model *restrict model, uint8_t* k, int8_t* k_trend,
+                                                       int8_t* k_fast_trend, const le_k_params* params, uint8_t* output,
+                                                       size_t i, size_t count, const uint32_t K, const le_promote_policy policy)
+{
+    const uint32_t* table = (K <= LE_TABLE_MAX_K && !model->custom_escape) ? le_decode_table() : NULL;
+    table = (table != NULL) ? table + (K << LE_TABLE_BITS) : NULL;
+    const uint32_t q_limit = model->q_escape[K];
+
+    while (i < count && *k == K && s->status == LE_OK)
+    {
+        if (K <= LE_TABLE_MAX_K && table != NULL)
+        {
+            if (s->bits_available < 32)
+                le_refill(s);
+
+            uint32_t entry = table[(uint32_t)(s->bit_reservoir & ((1U << LE_TABLE_BITS) - 1U))];
+            uint32_t values = entry & 7;
+
+            // no complete code in the window or not enough bits left : the slow path handles it
+            if (values > 0 && ((entry >> 3) & 15) <= s->bits_available)
+            {
+                uint32_t consumed = 0;
+                values = (values < count - i) ? values : (uint32_t)(count - i);
+
+                for (uint32_t j = 0; j < values; ++j)
+                {
+                    uint32_t index = (entry >> (7 + j * 6)) & 63;
+                    consumed += (index >> K) + 1 + K;
+                    output[i++] = model->alphabet[index];
+
+                    LE_STATS_VALUE(model, index, K);
+                    LE_STATS_INDEX(model, index);
+                    le_promote_ex(model, index, K, policy);
+                    le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+                    LE_STATS_K(model, K, *k);
+
+                    // the remaining values of the entry were decoded with the previous k
+                    if (*k != K)
+                        break;
+                }
+
+                s->bit_reservoir >>= consumed;
+                s->bits_available -= consumed;
+                continue;
+            }
+        }
+
+        uint8_t index = rice_decode(s, K, q_limit);
+        output[i++] = model->alphabet[index];
+        LE_STATS_VALUE(model, index, K);
+        LE_STATS_INDEX(model, index);
+        le_promote_ex(model, index, K, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+        LE_STATS_K(model, K, *k);
+    }
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// mirror of le_encode_symbols_runs()
+static LE_FORCE_INLINE size_t le_decode_symbols_runs(le_stream *restrict s, le_model *restrict model, uint8_t* k, int8_t* k_trend,
+                                                     int8_t* k_fast_trend, const le_k_params* params, uint8_t* output,
+                                                     size_t i, size_t count, const le_promote_policy policy)
+{
+    const uint32_t q_limit = model->q_escape[0];
+    while (i < count && *k == 0 && s->status == LE_OK)
+    {
+        if (!model->in_run)
+        {
+            uint8_t index = rice_decode(s, 0, q_limit);
+            output[i++] = model->alphabet[index];
+
+            LE_STATS_VALUE(model, index, 0);
+            LE_STATS_INDEX(model, index);
+            le_promote_ex(model, index, 0, policy);
+            le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+            LE_STATS_K(model, 0, *k);
+
+            model->zero_count = (index == 0 && model->zero_count < LE_RUN_THRESHOLD) ? model->zero_count + 1 : 0;
+            model->in_run = (model->zero_count == LE_RUN_THRESHOLD);
+            continue;
+        }
+
+        uint32_t bits = run_bits_for_index[model->run_index];
+        if (s->bits_available < 1 + bits)
+        {
+            le_refill(s);
+            if (s->bits_available < 1 + bits && (s->bits_available == 0 || (s->bit_reservoir & 1) == 0))
+            {
+                s->status = LE_BUFFER_OVERRUN;
+                break;
+            }
+        }
+
+        size_t run;
+        bool complete = (s->bit_reservoir & 1);
+        if (complete)
+        {
+            run = (size_t)1 << bits;
+            s->bit_reservoir >>= 1;
+            s->bits_available -= 1;
+            LE_STATS_RUN(model, (run < count - i) ? run : count - i, 1);
+            model->run_index += (model->run_index < LE_RUN_INDEX_MAX);
+        }
+        else
+        {
+            run = (size_t)(s->bit_reservoir >> 1) & (((size_t)1 << bits) - 1);
+            s->bit_reservoir >>= 1 + bits;
+            s->bits_available -= 1 + bits;
+            LE_STATS_RUN(model, (run < count - i) ? run : count - i, 1 + bits);
+            model->run_index -= (model->run_index > 0);
+        }
+
+        // the zeros past count belong to a segment closed at the end of the encoding call
+        size_t n = (run < count - i) ? run : count - i;
+        memset(output + i, model->alphabet[0], n);
+        i += n;
+
+        if (complete || i == count)
+            continue;
+
+        uint8_t index = (uint8_t)(rice_decode(s, 0, q_limit) + 1);
+        output[i++] = model->alphabet[index];
+
+        LE_STATS_VALUE(model, index - 1, 0);
+        LE_STATS_INDEX(model, index);
+        le_promote_ex(model, index, 0, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+        LE_STATS_K(model, 0, *k);
+
+        model->in_run = false;
+        model->zero_count = 0;
+    }
+
+    if (*k != 0)
+        model->zero_count = 0;
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_decode_symbols_ex(le_stream *restrict s, le_model *restrict model, uint8_t* output, size_t count,
+                                                 const le_promote_policy policy)
+{
+#ifdef LE_RANGE_CODER
+    // the kernels are rice only
+    if (s->backend == le_backend_range)
+    {
+        for (size_t i = 0; i < count && s->status == LE_OK; ++i)
+            output[i] = le_decode_symbol_ex(s, model, policy);
+        return;
+    }
+#endif
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    size_t i = 0;
+
+    while (i < count && stream.status == LE_OK)
+    {
+        if (model->runs && k == 0)
+        {
+            i = le_decode_symbols_runs(&stream, model, &k, &k_trend, &k_fast_trend, &params, output, i, count, policy);
+            continue;
+        }
+
+#define LE_RUN(K) i = le_decode_symbols_kernel(&stream, model, &k, &k_trend, &k_fast_trend, &params, output, i, count, K, policy)
+        LE_SWITCH_K(k, LE_RUN, stream.status = LE_INVALID_MODEL)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_symbols(le_stream *restrict s, le_model *restrict model, const uint8_t* input, size_t count)
+{
+    le_encode_symbols_ex(s, model, input, count, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_symbols(le_stream *restrict s, le_model *restrict model, uint8_t* output, size_t count)
+{
+    le_decode_symbols_ex(s, model, output, count, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t zigzag8_encode(int8_t v)
+{
+    return (uint8_t)(((uint8_t)v << 1) ^ (v >> 7));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int8_t zigzag8_decode(uint8_t v)
+{
+    return (int8_t)((v >> 1) ^ -(int8_t)(v & 1));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literal(le_stream *s, le_model* model, uint8_t value)
+{
+    le_entropy_encode(s, model, value);
+    le_model_update_k(model, value);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_decode_literal(le_stream* s, le_model* model)
+{
+    uint8_t value = le_entropy_decode(s, model);
+    le_model_update_k(model, value);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_delta(le_stream *s, le_model* model, int8_t delta)
+{
+    uint8_t zz = zigzag8_encode(delta);
+    le_entropy_encode(s, model, zz);
+    le_model_update_k(model, zz);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int8_t le_decode_delta(le_stream* s, le_model* model)
+{
+    uint8_t zz = le_entropy_decode(s, model);
+    le_model_update_k(model, zz);
+    return zigzag8_decode(zz);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_decode_literal_unchecked(le_stream* s, le_model* model)
+{
+    uint8_t value = le_entropy_decode_unchecked(s, model);
+    le_model_update_k(model, value);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int8_t le_decode_delta_unchecked(le_stream* s, le_model* model)
+{
+    uint8_t zz = le_entropy_decode_unchecked(s, model);
+    le_model_update_k(model, zz);
+    return zigzag8_decode(zz);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// literals and deltas share the same kernels, deltas are zigzag-encoded first
+static LE_FORCE_INLINE size_t le_encode_values_kernel(le_stream* s, le_model* model, uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend,
+                                                      const le_k_params* params, const uint8_t* input, size_t i, size_t count,
+                                                      bool zigzag, const uint32_t K)
+{
+    const uint32_t q_limit = model->q_escape[K];
+    while (i < count && *k == K && s->status == LE_OK)
+    {
+        uint8_t value = zigzag ? zigzag8_encode((int8_t)input[i++]) : input[i++];
+        rice_encode(s, value, K, q_limit);
+        LE_STATS_VALUE(model, value, K);
+        le_adapt_k(k, k_trend, k_fast_trend, value, 7, params);
+        LE_STATS_K(model, K, *k);
+    }
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE size_t le_decode_values_kernel(le_stream* s, le_model* model, uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend,
+                                                      const le_k_params* params, uint8_t* output, size_t i, size_t count,
+                                                      bool zigzag, const uint32_t K)
+{
+    const uint32_t q_limit = model->q_escape[K];
+    while (i < count && *k == K && s->status == LE_OK)
+    {
+        uint8_t value = rice_decode(s, K, q_limit);
+        LE_STATS_VALUE(model, value, K);
+        le_adapt_k(k, k_trend, k_fast_trend, value, 7, params);
+        LE_STATS_K(model, K, *k);
+        output[i++] = zigzag ? (uint8_t)zigzag8_decode(value) : value;
+    }
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_encode_values(le_stream *restrict s, le_model *restrict model, const uint8_t* input, size_t count, bool zigzag)
+{
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+    {
+        for (size_t i = 0; i < count && s->status == LE_OK; ++i)
+        {
+            if (zigzag)
+                le_encode_delta(s, model, (int8_t)input[i]);
+            else
+                le_encode_literal(s, model, input[i]);
+        }
+        return;
+    }
+#endif
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    size_t i = 0;
+
+    while (i < count && stream.status == LE_OK)
+    {
+#define LE_RUN(K) i = le_encode_values_kernel(&stream, model, &k, &k_trend, &k_fast_trend, &params, input, i, count, zigzag, K)
+        LE_SWITCH_K(k, LE_RUN, stream.status = LE_INVALID_MODEL)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_decode_values(le_stream *restrict s, le_model *restrict model, uint8_t* output, size_t count, bool zigzag)
+{
+#ifdef LE_RANGE_CODER
+    if (s->backend == le_backend_range)
+    {
+        for (size_t i = 0; i < count && s->status == LE_OK; ++i)
+            output[i] = zigzag ? (uint8_t)le_decode_delta(s, model) : le_decode_literal(s, model);
+        return;
+    }
+#endif
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    size_t i = 0;
+
+    while (i < count && stream.status == LE_OK)
+    {
+#define LE_RUN(K) i = le_decode_values_kernel(&stream, model, &k, &k_trend, &k_fast_trend, &params, output, i, count, zigzag, K)
+        LE_SWITCH_K(k, LE_RUN, stream.status = LE_INVALID_MODEL)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literals(le_stream *restrict s, le_model *restrict model, const uint8_t* input, size_t count)
+{
+    le_encode_values(s, model, input, count, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_literals(le_stream *restrict s, le_model *restrict model, uint8_t* output, size_t count)
+{
+    le_decode_values(s, model, output, count, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_deltas(le_stream *restrict s, le_model *restrict model, const int8_t* input, size_t count)
+{
+    le_encode_values(s, model, (const uint8_t*)input, count, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_deltas(le_stream *restrict s, le_model *restrict model, int8_t* output, size_t count)
+{
+    le_decode_values(s, model, (uint8_t*)output, count, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// bit-cost estimation : the same model adaptation as the bulk encode functions (promotion, soft-K, zero-run mode), only
+// the codeword lengths are summed and nothing is written. The result is the exact size in bits of the rice codewords,
+// le_end_encode() pads the last byte. The model is left as the encoder would leave it : estimate on a copy to compare
+// apis or parameters before coding a block. The range coder backend isn't estimated. UINT64_MAX for an invalid model.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// rice codeword length of an 8-bit value at k
+static inline uint32_t le_code_bits(uint32_t value, uint32_t k, uint32_t q_limit)
+{
+    uint32_t q = value >> k;
+    return (q >= q_limit) ? q_limit + 1 + 8 : q + 1 + k;
+}
+
+#if defined(LE_SSE2) || defined(LE_NEON)
+// ----------------------------------------------------------------------------------------------------------------------------
+// codeword lengths of 16 values at k and the soft-K signals they raise : *down counts the values below lower, *up the
+// values above upper. lower = 0 or upper >= 255 disables the signal, the two ranges must not overlap.
+static inline uint32_t le_estimate_block16(const uint8_t* input, bool zigzag, uint32_t k, uint32_t q_limit, uint32_t lower,
+                                           uint32_t upper, uint32_t* down, uint32_t* up)
+{
+    const uint8_t below = (uint8_t)((lower > 256 ? 256 : lower) - 1);
+#if defined(LE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i v_limit = _mm_set1_epi8((char)q_limit);
+    __m128i v = _mm_loadu_si128((const __m128i*)input);
+    if (zigzag)
+        v = _mm_xor_si128(_mm_add_epi8(v, v), _mm_cmpgt_epi8(zero, v));
+
+    // q = min(value >> k, L), the escape adds 8 - k bits to q + 1 + k
+    __m128i q = _mm_and_si128(_mm_srl_epi16(v, _mm_cvtsi32_si128((int)k)), _mm_set1_epi8((char)(0xFF >> k)));
+    q = _mm_min_epu8(q, v_limit);
+    __m128i escape = _mm_and_si128(_mm_cmpeq_epi8(q, v_limit), _mm_set1_epi8((char)(8 - k)));
+    __m128i bits = _mm_add_epi8(_mm_add_epi8(q, _mm_set1_epi8((char)(1 + k))), escape);
+
+    __m128i v_below = _mm_set1_epi8((char)below);
+    __m128i v_upper = _mm_set1_epi8((char)upper);
+    __m128i is_down = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, v_below), v), one);
+    __m128i is_up = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, v_upper), v), one);
+
+    // horizontal sums, 16 * LE_MAX_CODE_BITS at most
+    __m128i sum_bits = _mm_sad_epu8(bits, zero);
+    __m128i sum_down = _mm_sad_epu8(is_down, zero);
+    __m128i sum_up = _mm_sad_epu8(is_up, zero);
+    *down = (lower > 0) ? (uint32_t)(_mm_cvtsi128_si32(sum_down) + _mm_extract_epi16(sum_down, 4)) : 0;
+    *up = (upper < 255) ? (uint32_t)(_mm_cvtsi128_si32(sum_up) + _mm_extract_epi16(sum_up, 4)) : 0;
+    return (uint32_t)(_mm_cvtsi128_si32(sum_bits) + _mm_extract_epi16(sum_bits, 4));
+#else
+    const uint8x16_t one = vdupq_n_u8(1);
+    const uint8x16_t v_limit = vdupq_n_u8((uint8_t)q_limit);
+    uint8x16_t v = vld1q_u8(input);
+    if (zigzag)
+        v = veorq_u8(vshlq_n_u8(v, 1), vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(v), 7)));
+
+    uint8x16_t q = vminq_u8(vshlq_u8(v, vdupq_n_s8((int8_t)-(int32_t)k)), v_limit);
+    uint8x16_t escape = vandq_u8(vceqq_u8(q, v_limit), vdupq_n_u8((uint8_t)(8 - k)));
+    uint8x16_t bits = vaddq_u8(vaddq_u8(q, vdupq_n_u8((uint8_t)(1 + k))), escape);
+
+    uint8x16_t is_down = vandq_u8(vcleq_u8(v, vdupq_n_u8(below)), one);
+    uint8x16_t is_up = vandq_u8(vcgtq_u8(v, vdupq_n_u8((uint8_t)upper)), one);
+
+    uint64x2_t sum_bits = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(bits)));
+    uint64x2_t sum_down = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(is_down)));
+    uint64x2_t sum_up = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(is_up)));
+    *down = (lower > 0) ? (uint32_t)(vgetq_lane_u64(sum_down, 0) + vgetq_lane_u64(sum_down, 1)) : 0;
+    *up = (upper < 255) ? (uint32_t)(vgetq_lane_u64(sum_up, 0) + vgetq_lane_u64(sum_up, 1)) : 0;
+    return (uint32_t)(vgetq_lane_u64(sum_bits, 0) + vgetq_lane_u64(sum_bits, 1));
+#endif
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// estimates the literals or the zigzag-encoded deltas while k == K, returns the position of the first value not estimated
+static LE_FORCE_INLINE size_t le_estimate_values_kernel(le_model* model, uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend,
+                                                        const le_k_params* params, const uint8_t* input, size_t i, size_t count,
+                                                        bool zigzag, const uint32_t K, uint64_t* bits)
+{
+    const uint32_t q_limit = model->q_escape[K];
+    uint64_t total = *bits;
+
+#if defined(LE_SSE2) || defined(LE_NEON)
+    // 16 values at once when k can't change inside the block : without dual-rate, the trend stays within the threshold
+    // whatever the order of the signals if it does with all the up signals first and with all the down signals first
+    const bool blocks = (params->fast_threshold == 0);
+    const uint32_t lower = (K > 0) ? (uint32_t)params->low << K : 0;
+    const uint32_t upper = (K < 7) ? (uint32_t)params->high << K : 255;
+#endif
+
+    while (i < count && *k == K)
+    {
+        size_t end = count;
+#if defined(LE_SSE2) || defined(LE_NEON)
+        if (blocks && count - i >= 16)
+        {
+            uint32_t down, up;
+            uint32_t block_bits = le_estimate_block16(input + i, zigzag, K, q_limit, lower, upper, &down, &up);
+            if (*k_trend + (int32_t)up <= params->threshold && *k_trend - (int32_t)down >= -params->threshold)
+            {
+                total += block_bits;
+                *k_trend = (int8_t)(*k_trend + (int32_t)up - (int32_t)down);
+                i += 16;
+                continue;
+            }
+        }
+
+        // the block changes k : one value at a time, then back to the blocks
+        end = (count - i > 16) ? i + 16 : count;
+#endif
+        while (i < end && *k == K)
+        {
+            uint8_t value = zigzag ? zigzag8_encode((int8_t)input[i++]) : input[i++];
+            total += le_code_bits(value, K, q_limit);
+            le_adapt_k(k, k_trend, k_fast_trend, value, 7, params);
+        }
+    }
+
+    *bits = total;
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE uint64_t le_estimate_values(le_model* model, const uint8_t* input, size_t count, bool zigzag)
+{
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    while (i < count)
+    {
+#define LE_RUN(K) i = le_estimate_values_kernel(model, &k, &k_trend, &k_fast_trend, &params, input, i, count, zigzag, K, &bits)
+        LE_SWITCH_K(k, LE_RUN, return UINT64_MAX)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    return bits;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// the MTF promotion is sequential, the symbols are estimated one at a time (long moves still use le_index_increment())
+static LE_FORCE_INLINE size_t le_estimate_symbols_kernel(le_model* model, uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend,
+                                                         const le_k_params* params, const uint8_t* input, size_t i, size_t count,
+                                                         const uint32_t K, const le_promote_policy policy, uint64_t* bits)
+{
+    const uint32_t q_limit = model->q_escape[K];
+    uint64_t total = *bits;
+    while (i < count && *k == K)
+    {
+        uint32_t index = model->index[input[i++]];
+
+        total += le_code_bits(index, K, q_limit);
+        le_promote_ex(model, index, K, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+    }
+
+    *bits = total;
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// mirrors le_encode_symbols_runs()
+static LE_FORCE_INLINE size_t le_estimate_symbols_runs(le_model* model, uint8_t* k, int8_t* k_trend, int8_t* k_fast_trend,
+                                                       const le_k_params* params, const uint8_t* input, size_t i, size_t count,
+                                                       const le_promote_policy policy, uint64_t* bits)
+{
+    const uint32_t q_limit = model->q_escape[0];
+    uint64_t total = *bits;
+    while (i < count && *k == 0)
+    {
+        if (!model->in_run)
+        {
+            uint32_t index = model->index[input[i++]];
+
+            total += le_code_bits(index, 0, q_limit);
+            le_promote_ex(model, index, 0, policy);
+            le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+
+            model->zero_count = (index == 0 && model->zero_count < LE_RUN_THRESHOLD) ? model->zero_count + 1 : 0;
+            model->in_run = (model->zero_count == LE_RUN_THRESHOLD);
+            continue;
+        }
+
+        uint32_t run_bits = run_bits_for_index[model->run_index];
+        size_t segment = (size_t)1 << run_bits;
+        size_t run = 0;
+        uint8_t zero = model->alphabet[0];
+
+        while (run < segment && i + run < count && input[i + run] == zero)
+            run++;
+        i += run;
+
+        if (run == segment || i == count)
+        {
+            total += 1;
+            model->run_index += (model->run_index < LE_RUN_INDEX_MAX);
+            continue;
+        }
+
+        uint32_t index = model->index[input[i++]];
+        total += 1 + run_bits + le_code_bits(index - 1, 0, q_limit);
+        model->run_index -= (model->run_index > 0);
+
+        le_promote_ex(model, index, 0, policy);
+        le_adapt_k(k, k_trend, k_fast_trend, index, 7, params);
+
+        model->in_run = false;
+        model->zero_count = 0;
+    }
+
+    if (*k != 0)
+        model->zero_count = 0;
+
+    *bits = total;
+    return i;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// returns the size in bits le_encode_symbols_ex() would write, the policy must be a constant
+static LE_FORCE_INLINE uint64_t le_estimate_symbols_ex(le_model* model, const uint8_t* input, size_t count, const le_promote_policy policy)
+{
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    while (i < count)
+    {
+        if (model->runs && k == 0)
+        {
+            i = le_estimate_symbols_runs(model, &k, &k_trend, &k_fast_trend, &params, input, i, count, policy, &bits);
+            continue;
+        }
+
+#define LE_RUN(K) i = le_estimate_symbols_kernel(model, &k, &k_trend, &k_fast_trend, &params, input, i, count, K, policy, &bits)
+        LE_SWITCH_K(k, LE_RUN, return UINT64_MAX)
+#undef LE_RUN
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    return bits;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint64_t le_estimate_symbols(le_model* model, const uint8_t* input, size_t count)
+{
+    return le_estimate_symbols_ex(model, input, count, LE_PROMOTE_POLICY);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint64_t le_estimate_literals(le_model* model, const uint8_t* input, size_t count)
+{
+    return le_estimate_values(model, input, count, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint64_t le_estimate_deltas(le_model* model, const int8_t* input, size_t count)
+{
+    return le_estimate_values(model, (const uint8_t*)input, count, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint64_t le_estimate(le_model* model, const void* data, size_t size, le_api api)
+{
+    switch (api)
+    {
+    case le_api_symbol : return le_estimate_symbols(model, (const uint8_t*)data, size);
+    case le_api_literal : return le_estimate_literals(model, (const uint8_t*)data, size);
+    default : return le_estimate_deltas(model, (const int8_t*)data, size);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// estimates every api from a copy of the model and returns the cheapest one (the first in le_api order on a tie),
+// bits receives its size if not NULL. The model isn't modified.
+static inline le_api le_estimate_best_api(const le_model* model, const void* data, size_t size, uint64_t* bits)
+{
+    le_api best = le_api_symbol;
+    uint64_t best_bits = UINT64_MAX;
+    for (uint32_t api = le_api_symbol; api <= le_api_delta; ++api)
+    {
+        le_model copy = *model;
+        uint64_t estimate = le_estimate(&copy, data, size, (le_api)api);
+        if (estimate < best_bits)
+        {
+            best = (le_api)api;
+            best_bits = estimate;
+        }
+    }
+
+    if (bits != NULL)
+        *bits = best_bits;
+    return best;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// wide values : 16-bit and 32-bit literals and deltas, same rice coding and soft-K adaptation with k up to 15/31 and
+// a raw 16/32-bit escape. A model must not be shared between values of different widths.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t le_q_escape_wide(uint32_t k, uint32_t bits)
+{
+    return (bits == 16) ? q_escape_for_k16[k] : q_escape_for_k32[k];
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void rice_encode_wide(le_stream *s, uint32_t value, uint32_t k, uint32_t bits)
+{
+    uint32_t q = value >> k;
+    uint32_t q_limit = le_q_escape_wide(k, bits);
+
+    bool escape = (q >= q_limit);
+    q = escape ? q_limit : q;
+    uint32_t payload_bits = escape ? bits : k;
+    uint64_t payload = value & ((1ULL << payload_bits) - 1ULL);
+
+    // up to 49 bits, more than a single write accepts : unary prefix and payload are written separately
+    le_write_bits(s, (1ULL << q) - 1ULL, (uint8_t)(q + 1));
+    le_write_bits(s, payload, (uint8_t)payload_bits);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t rice_decode_wide(le_stream *s, uint32_t k, uint32_t bits)
+{
+    if (s->bits_available < LE_MAX_WIDE_CODE_BITS)
+        le_refill(s);
+
+    uint32_t q = le_ctz64(~s->bit_reservoir | (1ULL << 63));
+    uint32_t q_limit = le_q_escape_wide(k, bits);
+
+    bool escape = (q >= q_limit);
+    q = escape ? q_limit : q;
+    uint32_t payload_bits = escape ? bits : k;
+    uint32_t total_bits = q + 1 + payload_bits;
+
+    if (s->bits_available < total_bits)
+    {
+        s->status = LE_BUFFER_OVERRUN;
+        return 0;
+    }
+
+    uint32_t payload = (uint32_t)((s->bit_reservoir >> (q + 1)) & ((1ULL << payload_bits) - 1ULL));
+    s->bit_reservoir >>= total_bits;
+    s->bits_available -= total_bits;
+
+    return escape ? payload : ((q << k) | payload);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_model_update_k_wide(le_model* model, uint32_t value, uint32_t bits)
+{
+    LE_STATS_WIDE(model, value, model->k, bits);
+#ifdef LE_STATS
+    uint8_t old_k = model->k;
+#endif
+
+    le_adapt_k(&model->k, &model->k_trend, &model->k_fast_trend, value, bits - 1, &model->k_params);
+    LE_STATS_K(model, old_k, model->k);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint16_t zigzag16_encode(int16_t v)
+{
+    return (uint16_t)(((uint16_t)v << 1) ^ (v >> 15));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int16_t zigzag16_decode(uint16_t v)
+{
+    return (int16_t)((v >> 1) ^ -(int16_t)(v & 1));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t zigzag32_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int32_t zigzag32_decode(uint32_t v)
+{
+    return (int32_t)((v >> 1) ^ (0U - (v & 1)));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literal16(le_stream *s, le_model* model, uint16_t value)
+{
+    if (!le_require_rice(s))
+        return;
+
+    rice_encode_wide(s, value, model->k, 16);
+    le_model_update_k_wide(model, value, 16);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint16_t le_decode_literal16(le_stream* s, le_model* model)
+{
+    if (!le_require_rice(s))
+        return 0;
+
+    uint16_t value = (uint16_t)rice_decode_wide(s, model->k, 16);
+    le_model_update_k_wide(model, value, 16);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_delta16(le_stream *s, le_model* model, int16_t delta)
+{
+    if (!le_require_rice(s))
+        return;
+
+    uint16_t zz = zigzag16_encode(delta);
+    rice_encode_wide(s, zz, model->k, 16);
+    le_model_update_k_wide(model, zz, 16);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int16_t le_decode_delta16(le_stream* s, le_model* model)
+{
+    if (!le_require_rice(s))
+        return 0;
+
+    uint16_t zz = (uint16_t)rice_decode_wide(s, model->k, 16);
+    le_model_update_k_wide(model, zz, 16);
+    return zigzag16_decode(zz);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literal32(le_stream *s, le_model* model, uint32_t value)
+{
+    if (!le_require_rice(s))
+        return;
+
+    rice_encode_wide(s, value, model->k, 32);
+    le_model_update_k_wide(model, value, 32);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t le_decode_literal32(le_stream* s, le_model* model)
+{
+    if (!le_require_rice(s))
+        return 0;
+
+    uint32_t value = rice_decode_wide(s, model->k, 32);
+    le_model_update_k_wide(model, value, 32);
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_delta32(le_stream *s, le_model* model, int32_t delta)
+{
+    if (!le_require_rice(s))
+        return;
+
+    uint32_t zz = zigzag32_encode(delta);
+    rice_encode_wide(s, zz, model->k, 32);
+    le_model_update_k_wide(model, zz, 32);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline int32_t le_decode_delta32(le_stream* s, le_model* model)
+{
+    if (!le_require_rice(s))
+        return 0;
+
+    uint32_t zz = rice_decode_wide(s, model->k, 32);
+    le_model_update_k_wide(model, zz, 32);
+    return zigzag32_decode(zz);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// bulk wide values : same loop as the single value functions, with the stream state, k and k_trend in local variables
+static LE_FORCE_INLINE void le_encode_wide_values(le_stream *restrict s, le_model *restrict model, const void* input, size_t count,
+                                                  uint32_t bits, bool zigzag)
+{
+    if (!le_require_rice(s))
+        return;
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+
+    for (size_t i = 0; i < count && stream.status == LE_OK; ++i)
+    {
+        uint32_t value;
+        if (bits == 16)
+            value = zigzag ? zigzag16_encode(((const int16_t*)input)[i]) : ((const uint16_t*)input)[i];
+        else
+            value = zigzag ? zigzag32_encode(((const int32_t*)input)[i]) : ((const uint32_t*)input)[i];
+
+        rice_encode_wide(&stream, value, k, bits);
+        LE_STATS_WIDE(model, value, k, bits);
+#ifdef LE_STATS
+        uint8_t old_k = k;
+#endif
+        le_adapt_k(&k, &k_trend, &k_fast_trend, value, bits - 1, &params);
+        LE_STATS_K(model, old_k, k);
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static LE_FORCE_INLINE void le_decode_wide_values(le_stream *restrict s, le_model *restrict model, void* output, size_t count,
+                                                  uint32_t bits, bool zigzag)
+{
+    if (!le_require_rice(s))
+        return;
+
+    le_stream stream = *s;
+    uint8_t k = model->k;
+    int8_t k_trend = model->k_trend;
+    int8_t k_fast_trend = model->k_fast_trend;
+    const le_k_params params = model->k_params;
+
+    for (size_t i = 0; i < count && stream.status == LE_OK; ++i)
+    {
+        uint32_t value = rice_decode_wide(&stream, k, bits);
+        LE_STATS_WIDE(model, value, k, bits);
+#ifdef LE_STATS
+        uint8_t old_k = k;
+#endif
+        le_adapt_k(&k, &k_trend, &k_fast_trend, value, bits - 1, &params);
+        LE_STATS_K(model, old_k, k);
+
+        if (bits == 16)
+            ((uint16_t*)output)[i] = zigzag ? (uint16_t)zigzag16_decode((uint16_t)value) : (uint16_t)value;
+        else
+            ((uint32_t*)output)[i] = zigzag ? (uint32_t)zigzag32_decode(value) : value;
+    }
+
+    model->k = k;
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literals16(le_stream *restrict s, le_model *restrict model, const uint16_t* input, size_t count)
+{
+    le_encode_wide_values(s, model, input, count, 16, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_literals16(le_stream *restrict s, le_model *restrict model, uint16_t* output, size_t count)
+{
+    le_decode_wide_values(s, model, output, count, 16, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_deltas16(le_stream *restrict s, le_model *restrict model, const int16_t* input, size_t count)
+{
+    le_encode_wide_values(s, model, input, count, 16, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_deltas16(le_stream *restrict s, le_model *restrict model, int16_t* output, size_t count)
+{
+    le_decode_wide_values(s, model, output, count, 16, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_literals32(le_stream *restrict s, le_model *restrict model, const uint32_t* input, size_t count)
+{
+    le_encode_wide_values(s, model, input, count, 32, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_literals32(le_stream *restrict s, le_model *restrict model, uint32_t* output, size_t count)
+{
+    le_decode_wide_values(s, model, output, count, 32, false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_deltas32(le_stream *restrict s, le_model *restrict model, const int32_t* input, size_t count)
+{
+    le_encode_wide_values(s, model, input, count, 32, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_deltas32(le_stream *restrict s, le_model *restrict model, int32_t* output, size_t count)
+{
+    le_decode_wide_values(s, model, output, count, 32, true);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// context model : one MTF alphabet and k per context, the context is the previous symbol (order 1) or a hash of the last
+// 2 to 4 symbols. The contexts only keep the alphabet, the position of a symbol is searched, so the 256 contexts fit in
+// 66KB and are initialized on first use. Rice backend only, a range coder stream fails with LE_UNSUPPORTED_BACKEND.
+// The contexts have fixed settings : le_promote_half whatever LE_PROMOTE_POLICY is, initial k = 2, le_default_k_params
+// (no dual-rate), the default escape limits and no LE_STATS counters. le_k_params, le_model_set_escape() and the other
+// policies only apply to le_model.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+typedef struct le_context
+{
+    uint8_t alphabet[LE_ALPHABET_SIZE];
+    uint8_t k;
+    int8_t k_trend;
+} le_context;
+
+typedef struct le_context_model
+{
+    le_context contexts[LE_CONTEXT_COUNT];
+    uint64_t ready[LE_CONTEXT_COUNT / 64];  // contexts already initialized
+    uint32_t history;                       // last 4 symbols, the most recent in the low byte
+    uint32_t order;
+} le_context_model;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// order : number of previous symbols selecting the context, 1 to 4
+static inline void le_context_model_init(le_context_model* model, uint32_t order)
+{
+    memset(model->ready, 0, sizeof(model->ready));
+    model->history = 0;
+    model->order = (order < 1) ? 1 : (order > 4) ? 4 : order;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline le_context* le_context_select(le_context_model* model, uint32_t history)
+{
+    uint32_t c = history & 0xFF;
+    if (model->order > 1)
+    {
+        uint32_t mask = (model->order == 4) ? 0xFFFFFFFFU : ((1U << (model->order * 8)) - 1U);
+        c = ((history & mask) * 2654435761U) >> 24;
+    }
+
+    le_context* context = &model->contexts[c];
+    if ((model->ready[c >> 6] & (1ULL << (c & 63))) == 0)
+    {
+        for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+            context->alphabet[i] = (uint8_t)i;
+        context->k = 2;
+        context->k_trend = 0;
+        model->ready[c >> 6] |= 1ULL << (c & 63);
+    }
+    return context;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// le_promote_half (the default policy of le_promote()) without index table to update, LE_PROMOTE_POLICY isn't used
+static inline void le_context_promote(le_context* context, uint32_t index)
+{
+    if (index == 0 || context->k >= 6)
+        return;
+
+    uint32_t target = index / 2;
+    uint8_t value = context->alphabet[index];
+    memmove(context->alphabet + target + 1, context->alphabet + target, index - target);
+    context->alphabet[target] = value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_context_symbol(le_stream *restrict s, le_context_model *restrict model, uint8_t value)
+{
+    if (!le_require_rice(s))
+        return;
+
+    le_context* context = le_context_select(model, model->history);
+    uint32_t index = (uint32_t)((const uint8_t*)memchr(context->alphabet, value, LE_ALPHABET_SIZE) - context->alphabet);
+
+    rice_encode(s, index, context->k, q_escape_for_k[context->k]);
+    le_context_promote(context, index);
+    le_update_k(&context->k, &context->k_trend, index);
+    model->history = (model->history << 8) | value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t le_decode_context_symbol(le_stream *restrict s, le_context_model *restrict model)
+{
+    if (!le_require_rice(s))
+        return 0;
+
+    le_context* context = le_context_select(model, model->history);
+    uint8_t index = rice_decode(s, context->k, q_escape_for_k[context->k]);
+    uint8_t value = context->alphabet[index];
+
+    le_context_promote(context, index);
+    le_update_k(&context->k, &context->k_trend, index);
+    model->history = (model->history << 8) | value;
+    return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_encode_context_symbols(le_stream *restrict s, le_context_model *restrict model, const uint8_t* input, size_t count)
+{
+    le_stream stream = *s;
+    for (size_t i = 0; i < count && stream.status == LE_OK; ++i)
+        le_encode_context_symbol(&stream, model, input[i]);
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_decode_context_symbols(le_stream *restrict s, le_context_model *restrict model, uint8_t* output, size_t count)
+{
+    le_stream stream = *s;
+    for (size_t i = 0; i < count && stream.status == LE_OK; ++i)
+        output[i] = le_decode_context_symbol(&stream, model);
+    *s = stream;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// block mode : the input is split in blocks coded independently (fresh model for each block), the blocks can be 
+// encoded/decoded in parallel. The output starts with the end offset of each block (32 bits little endian, relative
+// to the end of the table) followed by the blocks data.
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// runs job(context, i) for i in [0, count[, possibly on several threads, and returns false if any job returned false
+typedef bool (*le_job_func)(void* context, size_t index);
+typedef bool (*le_parallel_for_func)(void* user_data, le_job_func job, void* context, size_t count);
+
+typedef struct le_blocks_job
+{
+    const uint8_t* input;
+    uint8_t* output;
+    size_t size;
+    size_t block_size;
+    size_t slot_size;
+    uint8_t* table;
+    le_api api;
+} le_blocks_job;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline bool le_parallel_for_sequential(void* user_data, le_job_func job, void* context, size_t count)
+{
+    (void) user_data;
+    bool success = true;
+    for (size_t i = 0; i < count; ++i)
+        success &= job(context, i);
+    return success;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t le_read32(const uint8_t* ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_write32(uint8_t* ptr, uint32_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+    ptr[2] = (uint8_t)(value >> 16);
+    ptr[3] = (uint8_t)(value >> 24);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// rounded up without computing size + block_size - 1, which wraps for sizes close to SIZE_MAX
+static inline size_t le_block_count(size_t size, size_t block_size)
+{
+    return size / block_size + (size % block_size != 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// output capacity needed by le_encode_blocks(), each block is first encoded in a worst case sized slot (25 bits per byte)
+// so the jobs can run in parallel without allocating : about 3.1 times the input, the compressed blocks are packed after
+static inline size_t le_blocks_bound(size_t size, size_t block_size)
+{
+    size_t slot_size = LE_MAX_ENCODED_SIZE(size < block_size ? size : block_size);
+    return le_block_count(size, block_size) * (sizeof(uint32_t) + slot_size);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// encodes a whole buffer with a fresh model, returns the compressed size (0 on error)
+static inline size_t le_encode_block(const void* input, size_t size, void* output, size_t capacity, le_api api)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, output, capacity);
+    le_model_init(&model);
+    le_begin_encode(&s);
+
+    switch (api)
+    {
+    case le_api_symbol : le_encode_symbols(&s, &model, (const uint8_t*)input, size); break;
+    case le_api_literal : le_encode_literals(&s, &model, (const uint8_t*)input, size); break;
+    case le_api_delta : le_encode_deltas(&s, &model, (const int8_t*)input, size); break;
+    }
+
+    return le_end_encode(&s);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline bool le_decode_block(const void* input, size_t input_size, void* output, size_t size, le_api api)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, (void*)input, input_size);
+    le_model_init(&model);
+    le_begin_decode(&s);
+
+    switch (api)
+    {
+    case le_api_symbol : le_decode_symbols(&s, &model, (uint8_t*)output, size); break;
+    case le_api_literal : le_decode_literals(&s, &model, (uint8_t*)output, size); break;
+    case le_api_delta : le_decode_deltas(&s, &model, (int8_t*)output, size); break;
+    }
+
+    le_end_decode(&s);
+    return s.status == LE_OK;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// encodes block[index] in its slot and stores its compressed size in the table
+static inline bool le_encode_block_job(void* context, size_t index)
+{
+    le_blocks_job* job = (le_blocks_job*) context;
+    size_t offset = index * job->block_size;
+    size_t size = (job->size - offset < job->block_size) ? job->size - offset : job->block_size;
+    size_t compressed_size = le_encode_block(job->input + offset, size, job->output + index * job->slot_size, job->slot_size, job->api);
+    le_write32(job->table + index * sizeof(uint32_t), (uint32_t)compressed_size);
+    return compressed_size > 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline bool le_decode_block_job(void* context, size_t index)
+{
+    le_blocks_job* job = (le_blocks_job*) context;
+    size_t offset = index * job->block_size;
+    size_t size = (job->size - offset < job->block_size) ? job->size - offset : job->block_size;
+    uint32_t start = (index > 0) ? le_read32(job->table + (index - 1) * sizeof(uint32_t)) : 0;
+    uint32_t end = le_read32(job->table + index * sizeof(uint32_t));
+
+    return le_decode_block(job->input + start, end - start, job->output + offset, size, job->api);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// output must be at least le_blocks_bound(size, block_size) bytes, parallel_for can be NULL to encode on the calling thread
+// returns the size of the output (0 on error)
+static inline size_t le_encode_blocks(const void* input, size_t size, void* output, size_t capacity, size_t block_size, le_api api,
+                                      le_parallel_for_func parallel_for, void* user_data)
+{
+    if (size == 0 || block_size == 0 || block_size > LE_MAX_BLOCK_SIZE || capacity < le_blocks_bound(size, block_size))
+        return 0;
+
+    size_t count = le_block_count(size, block_size);
+    size_t table_size = count * sizeof(uint32_t);
+    uint8_t* data = (uint8_t*)output + table_size;
+
+    le_blocks_job job =
+    {
+        .input = (const uint8_t*)input,
+        .output = data,
+        .size = size,
+        .block_size = block_size,
+        .slot_size = (capacity - table_size) / count,
+        .table = (uint8_t*)output,
+        .api = api
+    };
+
+    // each block goes in its own slot, the table receives the compressed sizes...
+    if (parallel_for == NULL)
+        parallel_for = le_parallel_for_sequential;
+
+    if (!parallel_for(user_data, le_encode_block_job, &job, count))
+        return 0;
+
+    // ...then the blocks are packed and the sizes converted to end offsets, stored on 32 bits : fails past 4GB of output
+    size_t end = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t block_compressed_size = le_read32(job.table + i * sizeof(uint32_t));
+        if ((uint64_t)end + block_compressed_size > UINT32_MAX)
+            return 0;
+
+        memmove(data + end, data + i * job.slot_size, block_compressed_size);
+        end += block_compressed_size;
+        le_write32(job.table + i * sizeof(uint32_t), (uint32_t)end);
+    }
+
+    return table_size + end;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// size and block_size must be the ones used for encoding, returns false on error
+static inline bool le_decode_blocks(const void* input, size_t input_size, void* output, size_t size, size_t block_size, le_api api,
+                                    le_parallel_for_func parallel_for, void* user_data)
+{
+    if (block_size == 0 || block_size > LE_MAX_BLOCK_SIZE)
+        return false;
+
+    size_t count = le_block_count(size, block_size);
+    size_t table_size = count * sizeof(uint32_t);
+    if (input_size < table_size)
+        return false;
+
+    // validates the offsets table before running the jobs
+    const uint8_t* table = (const uint8_t*)input;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t end = le_read32(table + i * sizeof(uint32_t));
+        if (end < previous || end > input_size - table_size)
+            return false;
+        previous = end;
+    }
+
+    le_blocks_job job =
+    {
+        .input = table + table_size,
+        .output = (uint8_t*)output,
+        .size = size,
+        .block_size = block_size,
+        .table = (uint8_t*)table,
+        .api = api
+    };
+
+    if (parallel_for == NULL)
+        parallel_for = le_parallel_for_sequential;
+
+    return parallel_for(user_data, le_decode_block_job, &job, count);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// frame : self-describing container around the block mode
+//
+//  offset  size  content
+//       0     4  magic "LENC"
+//       4     1  version
+//       5     1  flags, bits 0-1 : le_api used for all blocks, other bits must be 0
+//       6     2  reserved, must be 0
+//       8     8  original size
+//      16     4  block size
+//      20     4  block count
+//      24  4*n   end offset of each block, the compressed size of a block is the difference with the previous one
+//              followed by the blocks data
+//
+// all values are little endian
+// ----------------------------------------------------------------------------------------------------------------------------
+
+typedef struct le_frame_header
+{
+    uint64_t size;
+    uint32_t block_size;
+    uint32_t block_count;
+    le_api api;
+} le_frame_header;
+
+typedef struct le_frame_encoder
+{
+    le_stream stream;
+    le_model model;
+    le_frame_header header;
+    uint8_t* output;
+    size_t capacity;
+    size_t data_end;        // end of the last completed block, relative to the end of the table
+    uint64_t position;      // number of input bytes received
+    le_status status;
+} le_frame_encoder;
+
+typedef struct le_frame_decoder
+{
+    le_stream stream;
+    le_model model;
+    le_frame_header header;
+    const uint8_t* input;
+    size_t input_size;
+    uint64_t position;      // number of bytes decoded
+    le_status status;
+} le_frame_decoder;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_write64(uint8_t* ptr, uint64_t value)
+{
+    le_write32(ptr, (uint32_t)value);
+    le_write32(ptr + 4, (uint32_t)(value >> 32));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline uint64_t le_read64(const uint8_t* ptr)
+{
+    return (uint64_t)le_read32(ptr) | ((uint64_t)le_read32(ptr + 4) << 32);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline size_t le_frame_bound(size_t size, size_t block_size)
+{
+    return LE_FRAME_HEADER_SIZE + le_blocks_bound(size, block_size);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline void le_frame_write_header(uint8_t* output, const le_frame_header* header)
+{
+    le_write32(output, LE_FRAME_MAGIC);
+    output[4] = LE_FRAME_VERSION;
+    output[5] = (uint8_t)header->api;
+    output[6] = output[7] = 0;
+    le_write64(output + 8, header->size);
+    le_write32(output + 16, header->block_size);
+    le_write32(output + 20, header->block_count);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// reads and validates the header and the block table, the original size is known before decoding anything
+static inline bool le_frame_read_header(const void* input, size_t input_size, le_frame_header* header)
+{
+    const uint8_t* ptr = (const uint8_t*)input;
+    if (input_size < LE_FRAME_HEADER_SIZE || le_read32(ptr) != LE_FRAME_MAGIC || ptr[4] != LE_FRAME_VERSION ||
+        ptr[5] > le_api_delta || ptr[6] != 0 || ptr[7] != 0)
+        return false;
+
+    header->api = (le_api)ptr[5];
+    header->size = le_read64(ptr + 8);
+    header->block_size = le_read32(ptr + 16);
+    header->block_count = le_read32(ptr + 20);
+
+    // the blocks must cover the size exactly, computed on 64 bits so a huge size can't wrap to a small count
+    if (header->block_size == 0 || header->block_size > LE_MAX_BLOCK_SIZE || header->size > SIZE_MAX ||
+        header->block_count != header->size / header->block_size + (header->size % header->block_size != 0))
+        return false;
+
+    // the table must fit and the offsets must be increasing and inside the frame
+    size_t table_size = (size_t)header->block_count * sizeof(uint32_t);
+    if (input_size - LE_FRAME_HEADER_SIZE < table_size)
+        return false;
+
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < header->block_count; ++i)
+    {
+        uint32_t end = le_read32(ptr + LE_FRAME_HEADER_SIZE + i * sizeof(uint32_t));
+        if (end < previous || end > input_size - LE_FRAME_HEADER_SIZE - table_size)
+            return false;
+        previous = end;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// one shot encoding with optional parallel blocks, output must be at least le_frame_bound(size, block_size) bytes
+// returns the frame size (0 on error)
+static inline size_t le_frame_encode(const void* input, size_t size, void* output, size_t capacity, size_t block_size, le_api api,
+                                     le_parallel_for_func parallel_for, void* user_data)
+{
+    if (capacity < LE_FRAME_HEADER_SIZE)
+        return 0;
+
+    le_frame_header header = {.size = size, .block_size = (uint32_t)block_size, .block_count = 0, .api = api};
+    size_t blocks_size = 0;
+    if (size > 0)
+    {
+        blocks_size = le_encode_blocks(input, size, (uint8_t*)output + LE_FRAME_HEADER_SIZE, capacity - LE_FRAME_HEADER_SIZE,
+                                       block_size, api, parallel_for, user_data);
+        if (blocks_size == 0)
+            return 0;
+        header.block_count = (uint32_t)le_block_count(size, block_size);
+    }
+    else if (block_size == 0 || block_size > LE_MAX_BLOCK_SIZE)
+        return 0;
+
+    le_frame_write_header((uint8_t*)output, &header);
+    return LE_FRAME_HEADER_SIZE + blocks_size;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// one shot decoding, capacity must be at least the original size given by le_frame_read_header()
+static inline bool le_frame_decode(const void* input, size_t input_size, void* output, size_t capacity,
+                                   le_parallel_for_func parallel_for, void* user_data)
+{
+    le_frame_header header;
+    if (!le_frame_read_header(input, input_size, &header) || header.size > capacity)
+        return false;
+
+    if (header.size == 0)
+        return true;
+
+    return le_decode_blocks((const uint8_t*)input + LE_FRAME_HEADER_SIZE, input_size - LE_FRAME_HEADER_SIZE, output, (size_t)header.size,
+                            header.block_size, header.api, parallel_for, user_data);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// incremental encoder over an in-memory frame : the total size is known up front, the data can be given in any number
+// of pieces, but the whole frame is written in output (capacity bytes) and is only complete after le_frame_encoder_end().
+// The block table comes first, so nothing can be sent before the last block is encoded.
+static inline bool le_frame_encoder_init(le_frame_encoder* e, void* output, size_t capacity, size_t size, size_t block_size, le_api api)
+{
+    e->output = (uint8_t*)output;
+    e->capacity = capacity;
+    e->data_end = 0;
+    e->position = 0;
+    e->header.size = size;
+    e->header.block_size = (uint32_t)block_size;
+    e->header.api = api;
+    e->status = LE_OK;
+
+    if (block_size == 0 || block_size > LE_MAX_BLOCK_SIZE)
+    {
+        e->status = LE_INVALID_FRAME;
+        return false;
+    }
+
+    e->header.block_count = (uint32_t)le_block_count(size, block_size);
+    if (capacity < LE_FRAME_HEADER_SIZE + e->header.block_count * sizeof(uint32_t))
+    {
+        e->status = LE_BUFFER_OVERRUN;
+        return false;
+    }
+
+    le_frame_write_header(e->output, &e->header);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+static inline bool le_frame_encoder_write(le_frame_encoder* e, const void* input, size_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)input;
+    size_t table_size = e->header.block_count * sizeof(uint32_t);
+    uint8_t* data = e->output + LE_FRAME_HEADER_SIZE + table_size;
+
+    if (e->status == LE_OK && size > e->header.size - e->position)
+        e->status = LE_INVALID_FRAME;
+
+    while (size > 0 && e->status == LE_OK)
+    {
+        uint64_t block_offset = e->position % e->header.block_size;
+        uint32_t block_index = (uint32_t)(e->position / e->header.block_size);
+
+        // new block : fresh model and stream right after the previous block
+        if (block_offset == 0)
+        {
+            le_init(&e->stream, data + e->data_end, e->capacity - LE_FRAME_HEADER_SIZE - table_size - e->data_end);
+            le_model_init(&e->model);
+            le_begin_encode(&e->stream);
+        }
+
+        uint64_t block_end = (uint64_t)(block_index + 1) * e->header.block_size;
+        block_end = (block_end < e->header.size) ? block_end : e->header.size;
+        size_t count = (size < block_end - e->position) ? size : (size_t)(block_end - e->position);
+
+        switch (e->header.api)
+        {
+        case le_api_symbol : le_encode_symbols(&e->stream, &e->model, ptr, count); break;
+        case le_api_literal : le_encode_literals(&e->stream, &e->model, ptr, count); break;
+        case le_api_delta : le_encode_deltas(&e->stream, &e->model, (const int8_t*)ptr, count); break;
+        }
+
+        ptr += count;
+        size -= count;
+        e->position += count;
+
+        if (e->position == block_end)
+        {
+            size_t block_size = le_end_encode(&e->stream);
+            if (block_size == 0)
+            {
+                e->status = e->stream.status;
+                break;
+            }
+
+            // the end offsets are stored on 32 bits
+            if ((uint64_t)e->data_end + block_size > UINT32_MAX)
+            {
+                e->status = LE_INVALID_FRAME;
+                break;
+            }
+
+            e->data_end += block_size;
+            le_write32(e->output + LE_FRAME_HEADER_SIZE + block_index * sizeof(uint32_t), (uint32_t)e->data_end);
+        }
+    }
+
+    return e->status == LE_OK;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// returns the frame size, 0 if an error occured or if the data received doesn't match the size given at init
+static inline size_t le_frame_encoder_end(le_frame_encoder* e)
+{
+    if (e->status == LE_OK && e->position != e->header.size)
+        e->status = LE_INVALID_FRAME;
+
+    if (e->status != LE_OK)
+        return 0;
+
+    return LE_FRAME_HEADER_SIZE + e->header.block_count * sizeof(uint32_t) + e->data_end;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// incremental decoder over an in-memory frame : the whole frame must be in input, the decoded data can be retrieved
+// in pieces of any size. The header is available after init to allocate the output once
+static inline bool le_frame_decoder_init(le_frame_decoder* d, const void* input, size_t input_size)
+{
+    d->input = (const uint8_t*)input;
+    d->input_size = input_size;
+    d->position = 0;
+    d->status = le_frame_read_header(input, input_size, &d->header) ? LE_OK : LE_INVALID_FRAME;
+    return d->status == LE_OK;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// returns the location of block[index] in the frame
+static inline const uint8_t* le_frame_block(const le_frame_decoder* d, uint32_t index, size_t* compressed_size)
+{
+    const uint8_t* table = d->input + LE_FRAME_HEADER_SIZE;
+    uint32_t start = (index > 0) ? le_read32(table + (index - 1) * sizeof(uint32_t)) : 0;
+    uint32_t end = le_read32(table + index * sizeof(uint32_t));
+
+    *compressed_size = end - start;
+    return table + d->header.block_count * sizeof(uint32_t) + start;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// random access : decodes a whole block, output must hold header.block_size bytes (less for the last block)
+static inline bool le_frame_decode_block(const le_frame_decoder* d, uint32_t index, void* output)
+{
+    if (d->status != LE_OK || index >= d->header.block_count)
+        return false;
+
+    uint64_t offset = (uint64_t)index * d->header.block_size;
+    size_t size = (d->header.size - offset < d->header.block_size) ? (size_t)(d->header.size - offset) : d->header.block_size;
+    size_t compressed_size;
+    const uint8_t* block = le_frame_block(d, index, &compressed_size);
+
+    return le_decode_block(block, compressed_size, output, size, d->header.api);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// decodes the next bytes of the frame in order, returns the number of bytes written in output (0 at the end or on error)
+static inline size_t le_frame_decoder_read(le_frame_decoder* d, void* output, size_t size)
+{
+    uint8_t* ptr = (uint8_t*)output;
+    size_t total = 0;
+
+    while (size > 0 && d->status == LE_OK && d->position < d->header.size)
+    {
+        uint64_t block_offset = d->position % d->header.block_size;
+        uint32_t block_index = (uint32_t)(d->position / d->header.block_size);
+
+        if (block_offset == 0)
+        {
+            size_t compressed_size;
+            const uint8_t* block = le_frame_block(d, block_index, &compressed_size);
+            le_init(&d->stream, (void*)block, compressed_size);
+            le_model_init(&d->model);
+            le_begin_decode(&d->stream);
+        }
+
+        uint64_t block_end = (uint64_t)(block_index + 1) * d->header.block_size;
+        block_end = (block_end < d->header.size) ? block_end : d->header.size;
+        size_t count = (size < block_end - d->position) ? size : (size_t)(block_end - d->position);
+
+        switch (d->header.api)
+        {
+        case le_api_symbol : le_decode_symbols(&d->stream, &d->model, ptr, count); break;
+        case le_api_literal : le_decode_literals(&d->stream, &d->model, ptr, count); break;
+        case le_api_delta : le_decode_deltas(&d->stream, &d->model, (int8_t*)ptr, count); break;
+        }
+
+        if (d->position + count == block_end)
+            le_end_decode(&d->stream);
+
+        if (d->stream.status != LE_OK)
+        {
+            d->status = d->stream.status;
+            break;
+        }
+
+        ptr += count;
+        size -= count;
+        total += count;
+        d->position += count;
+    }
+
+    return total;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// model snapshots : a model trained on sample data is saved once, encoder and decoder then start from the same snapshot
+// instead of le_model_init(), small messages don't pay for the warm up anymore.
+// Layout (little endian) : magic(4) version(1) k(1) k_trend(1) k_fast_trend(1) initial_k(1) threshold(1) low(1) high(1)
+// fast_threshold(1) reserved(3) q_escape(8) alphabet(256)
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// adapts the model as if data was coded with the given api, without writing anything
+static inline void le_model_train(le_model* model, const void* data, size_t size, le_api api)
+{
+    const uint8_t* input = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        switch (api)
+        {
+        case le_api_symbol :
+        {
+            uint32_t index = model->index[input[i]];
+            LE_STATS_VALUE(model, index, model->k);
+            LE_STATS_INDEX(model, index);
+            le_model_promote(model, index);
+            le_model_update_k(model, (uint8_t)index);
+            break;
+        }
+        case le_api_literal :
+            LE_STATS_VALUE(model, input[i], model->k);
+            le_model_update_k(model, input[i]);
+            break;
+        case le_api_delta :
+        {
+            uint8_t zz = zigzag8_encode((int8_t)input[i]);
+            LE_STATS_VALUE(model, zz, model->k);
+            le_model_update_k(model, zz);
+            break;
+        }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// writes LE_SNAPSHOT_SIZE bytes
+static inline void le_model_save(const le_model* model, void* output)
+{
+    uint8_t* ptr = (uint8_t*)output;
+    le_write32(ptr, LE_SNAPSHOT_MAGIC);
+    ptr[4] = LE_SNAPSHOT_VERSION;
+    ptr[5] = model->k;
+    ptr[6] = (uint8_t)model->k_trend;
+    ptr[7] = (uint8_t)model->k_fast_trend;
+    ptr[8] = model->k_params.initial_k;
+    ptr[9] = model->k_params.threshold;
+    ptr[10] = model->k_params.low;
+    ptr[11] = model->k_params.high;
+    ptr[12] = model->k_params.fast_threshold;
+    memset(ptr + 13, 0, 3);
+    memcpy(ptr + 16, model->q_escape, LE_Q_ESCAPE_SIZE);
+    memcpy(ptr + 16 + LE_Q_ESCAPE_SIZE, model->alphabet, LE_ALPHABET_SIZE);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+// initializes the model from a snapshot, returns false (and leaves an initialized model) if the snapshot is invalid
+static inline bool le_model_load(le_model* model, const void* input, size_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)input;
+    le_model_init(model);
+
+    if (size < LE_SNAPSHOT_SIZE || le_read32(ptr) != LE_SNAPSHOT_MAGIC || ptr[4] != LE_SNAPSHOT_VERSION)
+        return false;
+
+    le_k_params params = {.initial_k = ptr[8], .threshold = ptr[9], .low = ptr[10], .high = ptr[11], .fast_threshold = ptr[12]};
+    if (!le_k_params_valid(&params))
+        return false;
+
+    int8_t k_trend = (int8_t)ptr[6];
+    int8_t k_fast_trend = (int8_t)ptr[7];
+    if (ptr[5] >= LE_Q_ESCAPE_SIZE || k_trend > params.threshold || k_trend < -params.threshold ||
+        k_fast_trend > params.fast_threshold || k_fast_trend < -params.fast_threshold)
+        return false;
+
+    // the alphabet must be a permutation
+    const uint8_t* alphabet = ptr + 16 + LE_Q_ESCAPE_SIZE;
+    uint8_t seen[LE_ALPHABET_SIZE] = {0};
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; ++i)
+    {
+        if (seen[alphabet[i]]++)
+            return false;
+    }
+
+    if (!le_model_set_escape(model, ptr + 16))
+        return false;
+
+    for (uint32_t i = 0; i < LE_ALPHABET_SIZE; ++i)
+    {
+        model->alphabet[i] = alphabet[i];
+        model->index[alphabet[i]] = (uint8_t)i;
+    }
+    model->k = ptr[5];
+    model->k_trend = k_trend;
+    model->k_fast_trend = k_fast_trend;
+    model->k_params = params;
+    return true;
 }
 
 #endif
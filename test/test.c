@@ -1,4 +1,10 @@
 #include "greatest.h"
+
+// the test_default target builds the default configuration, without the optional features
+#ifndef LE_TEST_DEFAULT
+    #define LE_FREQUENCY_RANKING
+    #define LE_RANGE_CODER
+#endif
 #include "../lite_encoding.h"
 #include "default_font_atlas.h"
 
@@ -98,6 +104,1597 @@ TEST overrun(void)
     PASS();
 }
 
+TEST padded(void)
+{
+    static uint8_t reference[32768];
+    static uint8_t buffer[32768 + LE_PADDING];
+
+    le_stream stream;
+    le_model model;
+
+    le_init(&stream, reference, sizeof(reference));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    size_t reference_size = le_end_encode(&stream);
+
+    le_init_padded(&stream, buffer, sizeof(buffer) - LE_PADDING);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    size_t size = le_end_encode(&stream);
+
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_EQ(reference_size, size);
+    ASSERT_MEM_EQ(reference, buffer, size);
+
+    // exact fit : the padding must not be counted as usable space
+    le_init_padded(&stream, buffer, size - 1);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    ASSERT_EQ(le_end_encode(&stream), 0);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+
+    PASS();
+}
+
+typedef struct sink_output
+{
+    uint8_t data[32768];
+    size_t size;
+    uint32_t chunks;
+} sink_output;
+
+static bool sink_write(void* user_data, const uint8_t* data, size_t size)
+{
+    sink_output* output = (sink_output*) user_data;
+    if (output->size + size > sizeof(output->data))
+        return false;
+
+    memcpy(output->data + output->size, data, size);
+    output->size += size;
+    output->chunks++;
+    return true;
+}
+
+typedef struct source_input
+{
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint32_t calls_after_end;
+} source_input;
+
+static size_t source_read(void* user_data, uint8_t* buffer, size_t capacity)
+{
+    source_input* input = (source_input*) user_data;
+    input->calls_after_end += (input->position == input->size);
+    size_t size = input->size - input->position;
+    size = (size < capacity) ? size : capacity;
+
+    memcpy(buffer, input->data + input->position, size);
+    input->position += size;
+    return size;
+}
+
+TEST sink(void)
+{
+    static uint8_t reference[32768];
+    static sink_output output;
+    uint8_t chunk[64 + LE_PADDING];
+
+    le_stream stream;
+    le_model model;
+
+    le_init(&stream, reference, sizeof(reference));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    size_t reference_size = le_end_encode(&stream);
+
+    for(uint32_t padded=0; padded<2; ++padded)
+    {
+        output.size = 0;
+        output.chunks = 0;
+
+        if (padded)
+            le_init_padded(&stream, chunk, sizeof(chunk) - LE_PADDING);
+        else
+            le_init(&stream, chunk, sizeof(chunk) - LE_PADDING);
+
+        le_set_sink(&stream, sink_write, &output);
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        for(uint32_t i=0; i<default_font_atlas_size; ++i)
+            le_encode_symbol(&stream, &model, default_font_atlas[i]);
+
+        ASSERT_EQ(reference_size, le_end_encode(&stream));
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_EQ(reference_size, output.size);
+        ASSERT_GT(output.chunks, 1);
+        ASSERT_MEM_EQ(reference, output.data, output.size);
+    }
+
+    // a failing sink stops the encoding
+    output.size = sizeof(output.data);
+    le_init(&stream, chunk, 64);
+    le_set_sink(&stream, sink_write, &output);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    ASSERT_EQ(le_end_encode(&stream), 0);
+    ASSERT_EQ(stream.status, LE_IO_ERROR);
+
+    // a zero-size buffer fails instead of writing past its end
+    output.size = 0;
+    chunk[0] = 0xA5;
+    le_init(&stream, chunk, 0);
+    le_set_sink(&stream, sink_write, &output);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<16; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    ASSERT_EQ(le_end_encode(&stream), 0);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+    ASSERT_EQ(chunk[0], 0xA5);
+
+    // the source doesn't replace the user data of the sink
+    source_input unused = {0};
+    output.size = 0;
+    le_init(&stream, chunk, 64);
+    le_set_sink(&stream, sink_write, &output);
+    le_set_source(&stream, source_read, &unused);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    ASSERT_EQ(reference_size, le_end_encode(&stream));
+    ASSERT_MEM_EQ(reference, output.data, output.size);
+
+    PASS();
+}
+
+TEST source(void)
+{
+    static uint8_t compressed[32768];
+    const size_t chunk_sizes[] = {1, 7, 13, 64};
+
+    le_stream stream;
+    le_model model;
+
+    le_init(&stream, compressed, sizeof(compressed));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    size_t compressed_size = le_end_encode(&stream);
+
+    // a padded buffer doesn't change the chunks : the bytes past the chunk are stale, not the next ones
+    for(uint32_t padded=0; padded<2; ++padded)
+        for(uint32_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); ++c)
+        {
+            uint8_t chunk[64 + LE_PADDING];
+            memset(chunk, 0xFF, sizeof(chunk));
+            source_input input = {.data = compressed, .size = compressed_size, .position = 0};
+
+            if (padded)
+                le_init_padded(&stream, chunk, chunk_sizes[c]);
+            else
+                le_init(&stream, chunk, chunk_sizes[c]);
+            le_set_source(&stream, source_read, &input);
+            le_model_init(&model);
+            le_begin_decode(&stream);
+
+            for(uint32_t i=0; i<default_font_atlas_size; ++i)
+                ASSERT_EQ(default_font_atlas[i], le_decode_symbol(&stream, &model));
+
+            ASSERT_EQ(stream.status, LE_OK);
+            le_end_decode(&stream);
+            ASSERT_EQ(stream.status, LE_OK);
+        }
+
+    // truncated source
+    uint8_t chunk[64];
+    source_input input = {.data = compressed, .size = compressed_size / 2, .position = 0};
+    le_init(&stream, chunk, sizeof(chunk));
+    le_set_source(&stream, source_read, &input);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_decode_symbol(&stream, &model);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+
+    // the source isn't called again once it returned 0, a new decoding starts over
+    ASSERT_EQ(input.calls_after_end, 1);
+    input.position = 0;
+    input.calls_after_end = 0;
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    le_decode_symbol(&stream, &model);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    PASS();
+}
+
+TEST unchecked(void)
+{
+    static uint8_t buffer[32768 + LE_PADDING];
+
+    le_stream stream;
+    le_model model;
+
+    le_init_padded(&stream, buffer, sizeof(buffer) - LE_PADDING);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    le_encode_literal(&stream, &model, 200);
+    le_encode_delta(&stream, &model, -100);
+    size_t size = le_end_encode(&stream);
+
+    le_init_padded(&stream, buffer, size);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        ASSERT_EQ(default_font_atlas[i], le_decode_symbol_unchecked(&stream, &model));
+    ASSERT_EQ(200, le_decode_literal_unchecked(&stream, &model));
+    ASSERT_EQ(-100, le_decode_delta_unchecked(&stream, &model));
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    // truncated stream : the overrun is only detected at the end
+    le_init_padded(&stream, buffer, size / 2);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_decode_symbol_unchecked(&stream, &model);
+    ASSERT_EQ(stream.status, LE_OK);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+
+    // ones past the end at k = 5 (no escape) : padded with 0xFF, then without padding
+    le_k_params large_k = le_default_k_params;
+    large_k.initial_k = 5;
+    uint8_t truncated[1 + LE_PADDING];
+    memset(truncated, 0xFF, sizeof(truncated));
+    truncated[0] = 0;
+    for(uint32_t padded=0; padded<2; ++padded)
+    {
+        if (padded)
+            le_init_padded(&stream, truncated, 1);
+        else
+            le_init(&stream, truncated, 1);
+        ASSERT(le_model_init_params(&model, &large_k));
+        le_begin_decode(&stream);
+        for(uint32_t i=0; i<3; ++i)
+            le_decode_literal_unchecked(&stream, &model);
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+    }
+
+    PASS();
+}
+
+TEST bulk_decode(void)
+{
+    static uint8_t buffer[32768];
+    static uint8_t input[32768];
+    static uint8_t output[32768];
+
+    // font atlas then a small-k stream to exercise the table
+    for(uint32_t i=0; i<32768; ++i)
+        input[i] = (i < 16384) ? default_font_atlas[i] : (uint8_t)((i * 2654435761U) >> 29) & ((i & 1024) ? 1 : 3);
+
+    le_stream stream;
+    le_model model;
+
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<32768; ++i)
+        le_encode_symbol(&stream, &model, input[i]);
+    size_t size = le_end_encode(&stream);
+
+    le_init(&stream, buffer, size);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &model, output, 32768);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_MEM_EQ(input, output, 32768);
+
+    // truncated stream
+    le_init(&stream, buffer, size / 2);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &model, output, 32768);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+
+    PASS();
+}
+
+TEST bulk(void)
+{
+    static uint8_t single[32768];
+    static uint8_t buffer[32768];
+    static uint8_t output[32768];
+    int8_t deltas[256], decoded_deltas[256];
+
+    for(uint32_t i=0; i<256; ++i)
+        deltas[i] = (int8_t)((i * 37) % 23 - 11);
+
+    le_stream stream;
+    le_model model[3];
+
+    // reference with the single value functions
+    le_init(&stream, single, sizeof(single));
+    for(uint32_t i=0; i<3; ++i)
+        le_model_init(&model[i]);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model[0], default_font_atlas[i]);
+    for(uint32_t i=0; i<1024; ++i)
+        le_encode_literal(&stream, &model[1], default_font_atlas[i] & 15);
+    for(uint32_t i=0; i<256; ++i)
+        le_encode_delta(&stream, &model[2], deltas[i]);
+    size_t single_size = le_end_encode(&stream);
+
+    le_init(&stream, buffer, sizeof(buffer));
+    for(uint32_t i=0; i<3; ++i)
+        le_model_init(&model[i]);
+    for(uint32_t i=0; i<1024; ++i)
+        output[i] = default_font_atlas[i] & 15;
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model[0], default_font_atlas, default_font_atlas_size);
+    le_encode_literals(&stream, &model[1], output, 1024);
+    le_encode_deltas(&stream, &model[2], deltas, 256);
+    size_t size = le_end_encode(&stream);
+
+    ASSERT_EQ(single_size, size);
+    ASSERT_MEM_EQ(single, buffer, size);
+
+    le_init(&stream, buffer, size);
+    for(uint32_t i=0; i<3; ++i)
+        le_model_init(&model[i]);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &model[0], output, default_font_atlas_size);
+    ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+    le_decode_literals(&stream, &model[1], output, 1024);
+    for(uint32_t i=0; i<1024; ++i)
+        ASSERT_EQ(default_font_atlas[i] & 15, output[i]);
+    le_decode_deltas(&stream, &model[2], decoded_deltas, 256);
+    ASSERT_MEM_EQ(deltas, decoded_deltas, 256);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    // stops at the first error
+    le_init(&stream, buffer, 64);
+    le_model_init(&model[0]);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model[0], default_font_atlas, default_font_atlas_size);
+    ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+    ASSERT_EQ(le_end_encode(&stream), 0);
+
+    PASS();
+}
+
+// jobs must not depend on each other
+static bool parallel_for_reversed(void* user_data, le_job_func job, void* context, size_t count)
+{
+    bool success = true;
+    for(size_t i=count; i-->0; )
+        success &= job(context, i);
+
+    (*(uint32_t*) user_data)++;
+    return success;
+}
+
+// doesn't run the jobs, reports compressed sizes whose sum doesn't fit the 32-bit offsets
+static bool parallel_for_oversized(void* user_data, le_job_func job, void* context, size_t count)
+{
+    (void)job;
+    (void)context;
+    for(size_t i=0; i<count; ++i)
+        le_write32((uint8_t*)user_data + i * sizeof(uint32_t), (i == 0) ? 1 : UINT32_MAX);
+    return true;
+}
+
+TEST blocks(void)
+{
+    static uint8_t input[32768 * 4];
+    static uint8_t output[32768 * 4];
+    static uint8_t compressed[32768 * 16];
+    const size_t block_size = 16384;
+
+    // 4 copies of the atlas, the last block is incomplete
+    size_t size = sizeof(input) - 1000;
+    for(uint32_t i=0; i<4; ++i)
+        memcpy(input + i * default_font_atlas_size, default_font_atlas, default_font_atlas_size);
+
+    ASSERT(le_blocks_bound(size, block_size) <= sizeof(compressed));
+    size_t compressed_size = le_encode_blocks(input, size, compressed, sizeof(compressed), block_size, le_api_symbol, NULL, NULL);
+    ASSERT(compressed_size > 0);
+
+    // single stream for comparison
+    le_stream stream;
+    le_model model;
+    le_init(&stream, output, sizeof(output));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, input, size);
+    printf("block mode : %zu bytes vs single stream : %zu bytes\n", compressed_size, le_end_encode(&stream));
+
+    memset(output, 0, sizeof(output));
+    ASSERT(le_decode_blocks(compressed, compressed_size, output, size, block_size, le_api_symbol, NULL, NULL));
+    ASSERT_MEM_EQ(input, output, size);
+
+    // same output with a different job order
+    static uint8_t reversed[32768 * 16];
+    uint32_t calls = 0;
+    ASSERT_EQ(compressed_size, le_encode_blocks(input, size, reversed, sizeof(reversed), block_size, le_api_symbol, parallel_for_reversed, &calls));
+    ASSERT_MEM_EQ(compressed, reversed, compressed_size);
+    memset(output, 0, sizeof(output));
+    ASSERT(le_decode_blocks(reversed, compressed_size, output, size, block_size, le_api_symbol, parallel_for_reversed, &calls));
+    ASSERT_MEM_EQ(input, output, size);
+    ASSERT_EQ(calls, 2);
+
+    // corrupted offsets table
+    ASSERT_FALSE(le_decode_blocks(compressed, compressed_size - 100, output, size, block_size, le_api_symbol, NULL, NULL));
+
+    // not enough room for the slots
+    ASSERT_EQ(le_encode_blocks(input, size, compressed, le_blocks_bound(size, block_size) - 1, block_size, le_api_symbol, NULL, NULL), 0);
+
+    // more than 4GB of compressed blocks
+    ASSERT_EQ(le_encode_blocks(input, size, compressed, sizeof(compressed), block_size, le_api_symbol, parallel_for_oversized, compressed), 0);
+
+    PASS();
+}
+
+TEST frame(void)
+{
+    static uint8_t compressed[32768 * 4];
+    static uint8_t streamed[32768 * 4];
+    static uint8_t output[32768];
+    const size_t block_size = 10000;
+
+    size_t frame_size = le_frame_encode(default_font_atlas, default_font_atlas_size, compressed, sizeof(compressed), block_size, le_api_literal, NULL, NULL);
+    ASSERT(frame_size > 0);
+
+    le_frame_header header;
+    ASSERT(le_frame_read_header(compressed, frame_size, &header));
+    ASSERT_EQ(header.size, default_font_atlas_size);
+    ASSERT_EQ(header.block_count, 4);
+    ASSERT_EQ(header.api, le_api_literal);
+
+    ASSERT(le_frame_decode(compressed, frame_size, output, sizeof(output), NULL, NULL));
+    ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+    ASSERT_FALSE(le_frame_decode(compressed, frame_size, output, sizeof(output) - 1, NULL, NULL));
+
+    // streaming encoder, fed with pieces that don't match the blocks : same frame
+    le_frame_encoder encoder;
+    ASSERT(le_frame_encoder_init(&encoder, streamed, sizeof(streamed), default_font_atlas_size, block_size, le_api_literal));
+    for(size_t i=0; i<default_font_atlas_size; i+=777)
+    {
+        size_t count = default_font_atlas_size - i;
+        ASSERT(le_frame_encoder_write(&encoder, default_font_atlas + i, count < 777 ? count : 777));
+    }
+    ASSERT_EQ(frame_size, le_frame_encoder_end(&encoder));
+    ASSERT_MEM_EQ(compressed, streamed, frame_size);
+
+    // streaming decoder
+    le_frame_decoder decoder;
+    memset(output, 0, sizeof(output));
+    ASSERT(le_frame_decoder_init(&decoder, compressed, frame_size));
+    size_t position = 0, count;
+    while ((count = le_frame_decoder_read(&decoder, output + position, 1234)) > 0)
+        position += count;
+    ASSERT_EQ(decoder.status, LE_OK);
+    ASSERT_EQ(position, default_font_atlas_size);
+    ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+
+    // random access
+    memset(output, 0, sizeof(output));
+    ASSERT(le_frame_decode_block(&decoder, 3, output));
+    ASSERT_MEM_EQ(default_font_atlas + 3 * block_size, output, default_font_atlas_size - 3 * block_size);
+
+    // too much data, truncated and corrupted frames
+    ASSERT(le_frame_encoder_init(&encoder, streamed, sizeof(streamed), 10, block_size, le_api_literal));
+    ASSERT_FALSE(le_frame_encoder_write(&encoder, default_font_atlas, 11));
+    ASSERT_EQ(le_frame_encoder_end(&encoder), 0);
+    ASSERT_FALSE(le_frame_read_header(compressed, frame_size - 1, &header));
+    compressed[5] = 7;
+    ASSERT_FALSE(le_frame_decoder_init(&decoder, compressed, frame_size));
+
+    // a size whose block count wraps to 0 : header only, no table
+    uint8_t wrapped[LE_FRAME_HEADER_SIZE] = {0};
+    le_write32(wrapped, LE_FRAME_MAGIC);
+    wrapped[4] = LE_FRAME_VERSION;
+    le_write64(wrapped + 8, UINT64_MAX);
+    le_write32(wrapped + 16, 2);
+    ASSERT_FALSE(le_frame_read_header(wrapped, sizeof(wrapped), &header));
+    ASSERT_FALSE(le_frame_decoder_init(&decoder, wrapped, sizeof(wrapped)));
+    ASSERT_EQ(le_frame_decoder_read(&decoder, output, sizeof(output)), 0);
+
+    PASS();
+}
+
+TEST wide(void)
+{
+    static int16_t deltas[4096], deltas_out[4096];
+    static uint32_t counters[4096], counters_out[4096];
+    static uint8_t buffer[65536], bulk_buffer[65536];
+
+    // smooth signal with a few large jumps and the extreme values
+    uint32_t seed = 12345;
+    for(uint32_t i=0; i<4096; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        deltas[i] = (int16_t)((int32_t)(seed >> 24) - 128);
+        counters[i] = i * 1000 + (seed >> 20);
+        if (i % 500 == 0)
+        {
+            deltas[i] = (i & 1) ? INT16_MAX : INT16_MIN;
+            counters[i] = UINT32_MAX - i;
+        }
+    }
+
+    le_stream stream;
+    le_model delta_model, counter_model;
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&delta_model);
+    le_model_init(&counter_model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<4096; ++i)
+    {
+        le_encode_delta16(&stream, &delta_model, deltas[i]);
+        le_encode_literal32(&stream, &counter_model, counters[i]);
+    }
+    size_t size = le_end_encode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    printf("wide values : %zu bytes for %zu bytes\n", size, sizeof(deltas) + sizeof(counters));
+
+    le_init(&stream, buffer, size);
+    le_model_init(&delta_model);
+    le_model_init(&counter_model);
+    le_begin_decode(&stream);
+    for(uint32_t i=0; i<4096; ++i)
+    {
+        ASSERT_EQ(le_decode_delta16(&stream, &delta_model), deltas[i]);
+        ASSERT_EQ(le_decode_literal32(&stream, &counter_model), counters[i]);
+    }
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    // bulk functions, one array after the other
+    le_init(&stream, bulk_buffer, sizeof(bulk_buffer));
+    le_model_init(&delta_model);
+    le_model_init(&counter_model);
+    le_begin_encode(&stream);
+    le_encode_deltas16(&stream, &delta_model, deltas, 4096);
+    le_encode_literals32(&stream, &counter_model, counters, 4096);
+    size = le_end_encode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    le_init(&stream, bulk_buffer, size);
+    le_model_init(&delta_model);
+    le_model_init(&counter_model);
+    le_begin_decode(&stream);
+    le_decode_deltas16(&stream, &delta_model, deltas_out, 4096);
+    le_decode_literals32(&stream, &counter_model, counters_out, 4096);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_MEM_EQ(deltas, deltas_out, sizeof(deltas));
+    ASSERT_MEM_EQ(counters, counters_out, sizeof(counters));
+
+    // same values through the single value functions give the same stream
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&delta_model);
+    le_model_init(&counter_model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<4096; ++i)
+        le_encode_delta16(&stream, &delta_model, deltas[i]);
+    for(uint32_t i=0; i<4096; ++i)
+        le_encode_literal32(&stream, &counter_model, counters[i]);
+    ASSERT_EQ(le_end_encode(&stream), size);
+    ASSERT_MEM_EQ(buffer, bulk_buffer, size);
+
+    // zigzag round trips
+    ASSERT_EQ(zigzag16_decode(zigzag16_encode(INT16_MIN)), INT16_MIN);
+    ASSERT_EQ(zigzag16_encode(-1), 1);
+    ASSERT_EQ(zigzag32_decode(zigzag32_encode(INT32_MIN)), INT32_MIN);
+    ASSERT_EQ(zigzag32_decode(zigzag32_encode(INT32_MAX)), INT32_MAX);
+
+    PASS();
+}
+
+TEST runs(void)
+{
+    static uint8_t input[65536], output[65536];
+    static uint8_t buffer[65536], plain[65536];
+    const size_t size = sizeof(input);
+
+    // long runs of a few symbols with some noise
+    uint32_t seed = 777;
+    for(size_t i=0; i<size; )
+    {
+        seed = seed * 1664525U + 1013904223U;
+        size_t run = 1 + ((seed >> 16) & 1023);
+        uint8_t value = (uint8_t)((seed >> 8) & 3);
+        for(size_t j=0; j<run && i<size; ++j)
+            input[i++] = value;
+    }
+
+    le_stream stream;
+    le_model model;
+    le_init(&stream, plain, sizeof(plain));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, input, size);
+    size_t plain_size = le_end_encode(&stream);
+
+    // chunked calls with another model in between, the decoder uses the same chunks
+    le_model other;
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&model);
+    le_model_init(&other);
+    le_model_enable_runs(&model);
+    le_begin_encode(&stream);
+    for(size_t i=0; i<size; i+=5000)
+    {
+        size_t count = (size - i < 5000) ? size - i : 5000;
+        le_encode_symbols(&stream, &model, input + i, count);
+        le_encode_literal(&stream, &other, (uint8_t)i);
+    }
+    size_t run_size = le_end_encode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    printf("zero-run mode : %zu bytes vs %zu bytes\n", run_size, plain_size);
+    ASSERT(run_size * 8 < size);
+    ASSERT(run_size < plain_size);
+
+    le_init(&stream, buffer, run_size);
+    le_model_init(&model);
+    le_model_init(&other);
+    le_model_enable_runs(&model);
+    le_begin_decode(&stream);
+    for(size_t i=0; i<size; i+=5000)
+    {
+        size_t count = (size - i < 5000) ? size - i : 5000;
+        le_decode_symbols(&stream, &model, output + i, count);
+        ASSERT_EQ(le_decode_literal(&stream, &other), (uint8_t)i);
+    }
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_MEM_EQ(input, output, size);
+
+    // font atlas round trip
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&model);
+    le_model_enable_runs(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, default_font_atlas, default_font_atlas_size);
+    size_t atlas_size = le_end_encode(&stream);
+    printf("font atlas with zero-run mode : %zu bytes\n", atlas_size);
+
+    le_init(&stream, buffer, atlas_size);
+    le_model_init(&model);
+    le_model_enable_runs(&model);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &model, output, default_font_atlas_size);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+
+    PASS();
+}
+
+#ifdef LE_RANGE_CODER
+TEST range_backend(void)
+{
+    static uint8_t input[65536], output[65536];
+    static uint8_t buffer[65536], bulk_buffer[65536];
+    const size_t size = sizeof(input);
+
+    // skewed distribution : rice can't go below one bit per symbol
+    uint32_t seed = 4242;
+    for(size_t i=0; i<size; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        uint32_t r = seed >> 24;
+        input[i] = (r < 200) ? 0 : (r < 240) ? 1 : (uint8_t)(r & 7);
+    }
+
+    for(uint32_t api = le_api_symbol; api <= le_api_delta; ++api)
+    {
+        le_stream stream;
+        le_model model;
+
+        le_init(&stream, buffer, sizeof(buffer));
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        for(size_t i=0; i<size; ++i)
+        {
+            if (api == le_api_symbol) le_encode_symbol(&stream, &model, input[i]);
+            if (api == le_api_literal) le_encode_literal(&stream, &model, input[i]);
+            if (api == le_api_delta) le_encode_delta(&stream, &model, (int8_t)input[i]);
+        }
+        size_t rice_size = le_end_encode(&stream);
+
+        le_init(&stream, buffer, sizeof(buffer));
+        le_set_backend(&stream, le_backend_range);
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        for(size_t i=0; i<size; ++i)
+        {
+            if (api == le_api_symbol) le_encode_symbol(&stream, &model, input[i]);
+            if (api == le_api_literal) le_encode_literal(&stream, &model, input[i]);
+            if (api == le_api_delta) le_encode_delta(&stream, &model, (int8_t)input[i]);
+        }
+        size_t range_size = le_end_encode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        printf("range coder : %zu bytes vs rice : %zu bytes\n", range_size, rice_size);
+        ASSERT(range_size < rice_size);
+
+        // bulk functions give the same stream
+        le_init(&stream, bulk_buffer, sizeof(bulk_buffer));
+        le_set_backend(&stream, le_backend_range);
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        if (api == le_api_symbol) le_encode_symbols(&stream, &model, input, size);
+        if (api == le_api_literal) le_encode_literals(&stream, &model, input, size);
+        if (api == le_api_delta) le_encode_deltas(&stream, &model, (const int8_t*)input, size);
+        ASSERT_EQ(le_end_encode(&stream), range_size);
+        ASSERT_MEM_EQ(buffer, bulk_buffer, range_size);
+
+        le_init(&stream, buffer, range_size);
+        le_set_backend(&stream, le_backend_range);
+        le_model_init(&model);
+        le_begin_decode(&stream);
+        if (api == le_api_symbol) le_decode_symbols(&stream, &model, output, size);
+        if (api == le_api_literal) le_decode_literals(&stream, &model, output, size);
+        if (api == le_api_delta) le_decode_deltas(&stream, &model, (int8_t*)output, size);
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(input, output, size);
+
+        // truncated stream
+        le_init(&stream, buffer, range_size / 2);
+        le_set_backend(&stream, le_backend_range);
+        le_model_init(&model);
+        le_begin_decode(&stream);
+        for(size_t i=0; i<size; ++i)
+            le_decode_symbol(&stream, &model);
+        ASSERT_EQ(stream.status, LE_BUFFER_OVERRUN);
+    }
+
+    // through a sink and a source
+    static sink_output sink;
+    le_stream stream;
+    le_model model;
+    uint8_t chunk[64];
+    le_init(&stream, chunk, sizeof(chunk));
+    le_set_sink(&stream, sink_write, &sink);
+    le_set_backend(&stream, le_backend_range);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, default_font_atlas, default_font_atlas_size);
+    size_t atlas_size = le_end_encode(&stream);
+    ASSERT_EQ(atlas_size, sink.size);
+    printf("font atlas with the range coder : %zu bytes\n", atlas_size);
+
+    source_input source = {.data = sink.data, .size = sink.size, .position = 0};
+    le_init(&stream, chunk, sizeof(chunk));
+    le_set_source(&stream, source_read, &source);
+    le_set_backend(&stream, le_backend_range);
+    le_model_init(&model);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &model, output, default_font_atlas_size);
+    le_end_decode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+    ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+
+    // the wide values are rice only
+    uint16_t wide[4] = {1, 300, 20000, 7};
+    for(uint32_t bulk=0; bulk<2; ++bulk)
+    {
+        le_init(&stream, buffer, sizeof(buffer));
+        le_set_backend(&stream, le_backend_range);
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        if (bulk)
+            le_encode_literals16(&stream, &model, wide, 4);
+        else
+            le_encode_literal16(&stream, &model, wide[0]);
+        ASSERT_EQ(stream.status, LE_UNSUPPORTED_BACKEND);
+        ASSERT_EQ(le_end_encode(&stream), 0);
+    }
+
+    PASS();
+}
+#endif
+
+TEST context_model(void)
+{
+    static uint8_t input[65536], output[65536], buffer[65536];
+    static le_context_model context_model;
+    const size_t size = sizeof(input);
+
+    // array of 8 bytes records : counter, type, flags, small signed value, padding
+    uint32_t seed = 99;
+    for(size_t i=0; i<size; i+=8)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        uint32_t id = (uint32_t)(i / 8);
+        input[i] = (uint8_t)id;
+        input[i+1] = (uint8_t)(id >> 8);
+        input[i+2] = (uint8_t)((seed >> 28) & 3);
+        input[i+3] = (input[i+2] == 0) ? 0x80 : 0x01;
+        input[i+4] = (uint8_t)(int8_t)((int32_t)((seed >> 12) & 15) - 8);
+        input[i+5] = (uint8_t)(seed >> 20);
+        input[i+6] = 0;
+        input[i+7] = 0xFF;
+    }
+
+    le_stream stream;
+    le_model model;
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, input, size);
+    size_t single_size = le_end_encode(&stream);
+
+    for(uint32_t order=1; order<=4; ++order)
+    {
+        le_init(&stream, buffer, sizeof(buffer));
+        le_context_model_init(&context_model, order);
+        le_begin_encode(&stream);
+        for(size_t i=0; i<size/2; ++i)
+            le_encode_context_symbol(&stream, &context_model, input[i]);
+        le_encode_context_symbols(&stream, &context_model, input + size/2, size - size/2);
+        size_t context_size = le_end_encode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        printf("order %u context model : %zu bytes vs single model : %zu bytes\n", order, context_size, single_size);
+        // the random byte of the records dilutes the higher orders
+        if (order <= 2)
+            ASSERT(context_size < single_size);
+
+        memset(output, 0, sizeof(output));
+        le_init(&stream, buffer, context_size);
+        le_context_model_init(&context_model, order);
+        le_begin_decode(&stream);
+        le_decode_context_symbols(&stream, &context_model, output, size/2);
+        for(size_t i=size/2; i<size; ++i)
+            output[i] = le_decode_context_symbol(&stream, &context_model);
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(input, output, size);
+    }
+
+#ifdef LE_RANGE_CODER
+    // rice only
+    le_init(&stream, buffer, sizeof(buffer));
+    le_set_backend(&stream, le_backend_range);
+    le_context_model_init(&context_model, 1);
+    le_begin_encode(&stream);
+    le_encode_context_symbols(&stream, &context_model, input, size);
+    ASSERT_EQ(stream.status, LE_UNSUPPORTED_BACKEND);
+    le_begin_decode(&stream);
+    ASSERT_EQ(le_decode_context_symbol(&stream, &context_model), 0);
+    ASSERT_EQ(stream.status, LE_UNSUPPORTED_BACKEND);
+#endif
+
+    PASS();
+}
+
+TEST snapshot(void)
+{
+    uint8_t snapshot[LE_SNAPSHOT_SIZE];
+    uint8_t buffer[1024], output[256];
+    const size_t half = default_font_atlas_size / 2;
+
+    // trained on the first half of the atlas
+    le_model model;
+    le_model_init(&model);
+    le_model_train(&model, default_font_atlas, half, le_api_symbol);
+    le_model_save(&model, snapshot);
+
+    le_model loaded;
+    ASSERT(le_model_load(&loaded, snapshot, sizeof(snapshot)));
+    ASSERT_MEM_EQ(model.alphabet, loaded.alphabet, LE_ALPHABET_SIZE);
+    ASSERT_MEM_EQ(model.index, loaded.index, LE_ALPHABET_SIZE);
+    ASSERT_EQ(model.k, loaded.k);
+    ASSERT_EQ(model.k_trend, loaded.k_trend);
+
+    // small messages from the second half
+    size_t fresh_total = 0, primed_total = 0;
+    for(size_t offset = half; offset + sizeof(output) <= default_font_atlas_size; offset += sizeof(output))
+    {
+        const uint8_t* message = default_font_atlas + offset;
+        le_stream stream;
+
+        le_init(&stream, buffer, sizeof(buffer));
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        le_encode_symbols(&stream, &model, message, sizeof(output));
+        fresh_total += le_end_encode(&stream);
+
+        le_init(&stream, buffer, sizeof(buffer));
+        ASSERT(le_model_load(&model, snapshot, sizeof(snapshot)));
+        le_begin_encode(&stream);
+        le_encode_symbols(&stream, &model, message, sizeof(output));
+        size_t size = le_end_encode(&stream);
+        primed_total += size;
+
+        le_init(&stream, buffer, size);
+        ASSERT(le_model_load(&model, snapshot, sizeof(snapshot)));
+        le_begin_decode(&stream);
+        le_decode_symbols(&stream, &model, output, sizeof(output));
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(message, output, sizeof(output));
+    }
+    printf("snapshot : %zu bytes vs fresh models : %zu bytes\n", primed_total, fresh_total);
+    ASSERT(primed_total < fresh_total);
+
+    // k above the byte kernels : rejected by the load, a corrupted model stops the bulk functions
+    uint8_t large_k[LE_SNAPSHOT_SIZE];
+    memcpy(large_k, snapshot, sizeof(large_k));
+    large_k[5] = 8;
+    large_k[6] = large_k[7] = 0;
+    ASSERT_FALSE(le_model_load(&model, large_k, sizeof(large_k)));
+    model.k = 8;
+    le_stream stream;
+    le_init(&stream, buffer, sizeof(buffer));
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, default_font_atlas, sizeof(output));
+    ASSERT_EQ(stream.status, LE_INVALID_MODEL);
+    ASSERT_EQ(le_estimate_literals(&model, default_font_atlas, sizeof(output)), UINT64_MAX);
+
+    // invalid snapshots
+    ASSERT_FALSE(le_model_load(&model, snapshot, sizeof(snapshot) - 1));
+    snapshot[LE_SNAPSHOT_SIZE - 1] = snapshot[LE_SNAPSHOT_SIZE - 2];
+    ASSERT_FALSE(le_model_load(&model, snapshot, sizeof(snapshot)));
+    snapshot[0] ^= 1;
+    ASSERT_FALSE(le_model_load(&model, snapshot, sizeof(snapshot)));
+    ASSERT_EQ(model.k, 2);
+
+    PASS();
+}
+
+TEST promote_policies(void)
+{
+    static uint8_t buffer[65536], bulk_buffer[65536], output[32768];
+#ifdef LE_FREQUENCY_RANKING
+    const le_promote_policy policies[] = {le_promote_half, le_promote_front, le_promote_quarter, le_promote_step, le_promote_frequency};
+    const char* names[] = {"half", "front", "quarter", "step", "frequency"};
+#else
+    const le_promote_policy policies[] = {le_promote_half, le_promote_front, le_promote_quarter, le_promote_step};
+    const char* names[] = {"half", "front", "quarter", "step"};
+#endif
+
+    for(uint32_t p=0; p<sizeof(policies)/sizeof(policies[0]); ++p)
+    {
+        le_stream stream;
+        le_model model;
+
+        // the policy must be a constant, one call per policy
+        le_init(&stream, buffer, sizeof(buffer));
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        {
+            switch (policies[p])
+            {
+            case le_promote_half : le_encode_symbol_ex(&stream, &model, default_font_atlas[i], le_promote_half); break;
+            case le_promote_front : le_encode_symbol_ex(&stream, &model, default_font_atlas[i], le_promote_front); break;
+            case le_promote_quarter : le_encode_symbol_ex(&stream, &model, default_font_atlas[i], le_promote_quarter); break;
+            case le_promote_step : le_encode_symbol_ex(&stream, &model, default_font_atlas[i], le_promote_step); break;
+#ifdef LE_FREQUENCY_RANKING
+            case le_promote_frequency : le_encode_symbol_ex(&stream, &model, default_font_atlas[i], le_promote_frequency); break;
+#endif
+            }
+        }
+        size_t size = le_end_encode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        printf("%s promotion : %zu bytes\n", names[p], size);
+
+        le_init(&stream, bulk_buffer, sizeof(bulk_buffer));
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        switch (policies[p])
+        {
+        case le_promote_half : le_encode_symbols_ex(&stream, &model, default_font_atlas, default_font_atlas_size, le_promote_half); break;
+        case le_promote_front : le_encode_symbols_ex(&stream, &model, default_font_atlas, default_font_atlas_size, le_promote_front); break;
+        case le_promote_quarter : le_encode_symbols_ex(&stream, &model, default_font_atlas, default_font_atlas_size, le_promote_quarter); break;
+        case le_promote_step : le_encode_symbols_ex(&stream, &model, default_font_atlas, default_font_atlas_size, le_promote_step); break;
+#ifdef LE_FREQUENCY_RANKING
+        case le_promote_frequency : le_encode_symbols_ex(&stream, &model, default_font_atlas, default_font_atlas_size, le_promote_frequency); break;
+#endif
+        }
+        ASSERT_EQ(le_end_encode(&stream), size);
+        ASSERT_MEM_EQ(buffer, bulk_buffer, size);
+
+        le_init(&stream, buffer, size);
+        le_model_init(&model);
+        le_begin_decode(&stream);
+        switch (policies[p])
+        {
+        case le_promote_half : le_decode_symbols_ex(&stream, &model, output, default_font_atlas_size, le_promote_half); break;
+        case le_promote_front : le_decode_symbols_ex(&stream, &model, output, default_font_atlas_size, le_promote_front); break;
+        case le_promote_quarter : le_decode_symbols_ex(&stream, &model, output, default_font_atlas_size, le_promote_quarter); break;
+        case le_promote_step : le_decode_symbols_ex(&stream, &model, output, default_font_atlas_size, le_promote_step); break;
+#ifdef LE_FREQUENCY_RANKING
+        case le_promote_frequency : le_decode_symbols_ex(&stream, &model, output, default_font_atlas_size, le_promote_frequency); break;
+#endif
+        }
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(default_font_atlas, output, default_font_atlas_size);
+    }
+
+    PASS();
+}
+
+TEST k_params(void)
+{
+    static uint8_t input[16384], output[16384], buffer[32768], bulk_buffer[32768];
+    const size_t size = sizeof(input);
+
+    // frames switching between small and large values
+    uint32_t seed = 12345;
+    for(size_t i=0; i<size; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        input[i] = ((i / 512) & 1) ? (uint8_t)(64 + ((seed >> 24) & 127)) : (uint8_t)((seed >> 24) & 3);
+    }
+
+    le_k_params dual = le_default_k_params;
+    dual.fast_threshold = 3;
+    const le_k_params* configs[] = {&le_default_k_params, &dual};
+    size_t sizes[2];
+
+    for(uint32_t c=0; c<2; ++c)
+    {
+        le_stream stream, bulk_stream;
+        le_model model, bulk_model;
+
+        // bulk and single value functions give the same stream
+        le_init(&stream, buffer, sizeof(buffer));
+        le_model_init_params(&model, configs[c]);
+        le_begin_encode(&stream);
+        for(size_t i=0; i<size; ++i)
+            le_encode_literal(&stream, &model, input[i]);
+        sizes[c] = le_end_encode(&stream);
+
+        le_init(&bulk_stream, bulk_buffer, sizeof(bulk_buffer));
+        le_model_init_params(&bulk_model, configs[c]);
+        le_begin_encode(&bulk_stream);
+        le_encode_literals(&bulk_stream, &bulk_model, input, size);
+        ASSERT_EQ(le_end_encode(&bulk_stream), sizes[c]);
+        ASSERT_MEM_EQ(buffer, bulk_buffer, sizes[c]);
+
+        le_init(&stream, buffer, sizes[c]);
+        le_model_init_params(&model, configs[c]);
+        le_begin_decode(&stream);
+        le_decode_literals(&stream, &model, output, size);
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(input, output, size);
+    }
+    printf("single rate : %zu bytes, dual rate : %zu bytes\n", sizes[0], sizes[1]);
+    ASSERT(sizes[1] < sizes[0]);
+
+    // the default parameters don't change the stream
+    le_stream stream;
+    le_model model;
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init_params(&model, &le_default_k_params);
+    le_begin_encode(&stream);
+    le_encode_literals(&stream, &model, input, size);
+    size_t default_size = le_end_encode(&stream);
+    le_init(&stream, bulk_buffer, sizeof(bulk_buffer));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_literals(&stream, &model, input, size);
+    ASSERT_EQ(le_end_encode(&stream), default_size);
+    ASSERT_MEM_EQ(buffer, bulk_buffer, default_size);
+
+    // k out of the byte kernels, trends that would overflow, overlapping bands
+    le_k_params invalid[4] = {le_default_k_params, le_default_k_params, le_default_k_params, le_default_k_params};
+    invalid[0].initial_k = 8;
+    invalid[1].threshold = 127;
+    invalid[2].fast_threshold = 200;
+    invalid[3].low = 4;
+    for(uint32_t i=0; i<4; ++i)
+    {
+        ASSERT_FALSE(le_model_init_params(&model, &invalid[i]));
+        ASSERT_EQ(model.k, le_default_k_params.initial_k);
+        ASSERT_EQ(model.k_params.threshold, le_default_k_params.threshold);
+    }
+    ASSERT(le_model_init_params(&model, &dual));
+
+    // snapshots keep the parameters
+    uint8_t snapshot[LE_SNAPSHOT_SIZE];
+    le_model loaded;
+    le_model_init_params(&model, &dual);
+    le_model_train(&model, input, 1000, le_api_literal);
+    le_model_save(&model, snapshot);
+    ASSERT(le_model_load(&loaded, snapshot, sizeof(snapshot)));
+    ASSERT_EQ(loaded.k_params.fast_threshold, 3);
+    ASSERT_EQ(loaded.k_fast_trend, model.k_fast_trend);
+    ASSERT_EQ(loaded.k, model.k);
+
+    // the load checks the parameters like le_model_init_params()
+    snapshot[8] = 8;
+    ASSERT_FALSE(le_model_load(&loaded, snapshot, sizeof(snapshot)));
+    snapshot[8] = 2;
+    snapshot[10] = 4;
+    ASSERT_FALSE(le_model_load(&loaded, snapshot, sizeof(snapshot)));
+
+    PASS();
+}
+
+static uint32_t escape_rule(uint32_t k, uint32_t bits)
+{
+    uint32_t limit = (bits - k > 4) ? bits - k : 4;
+    limit = (limit > 16) ? 16 : limit;
+    uint64_t q_max = (((uint64_t)1 << bits) - 1) >> k;
+    return (limit + 1 + bits < q_max + 1 + k) ? limit : 255;
+}
+
+TEST escape(void)
+{
+    static uint8_t input[8192], output[8192], buffer[16384], bulk_buffer[16384];
+    const size_t size = sizeof(input);
+
+    // the tight table follows the break-even rule
+    for(uint32_t k=0; k<LE_Q_ESCAPE_SIZE; ++k)
+        ASSERT_EQ(q_escape_tight[k], escape_rule(k, 8));
+
+    // the default limits are the format of the raw streams
+    const uint8_t default_limits[LE_Q_ESCAPE_SIZE] = {16, 10, 4, 6, 255, 255, 255, 255};
+    ASSERT_MEM_EQ(default_limits, q_escape_for_k, LE_Q_ESCAPE_SIZE);
+    for(uint32_t k=0; k<16; ++k)
+        ASSERT_EQ(q_escape_for_k16[k], (k < 12) ? 16 : 255);
+    for(uint32_t k=0; k<32; ++k)
+        ASSERT_EQ(q_escape_for_k32[k], (k < 28) ? 16 : 255);
+
+    // literals reaching k = 4 with outliers, encoded by the first version of the library
+    static const uint8_t first_version[] =
+    {
+        0xAF, 0xE2, 0xB1, 0xBC, 0x8D, 0x67, 0xF2, 0x3E, 0x5E, 0xCB, 0x9B, 0x78, 0x1F, 0xAF, 0xE2, 0xAD,
+        0xBC, 0x89, 0xC7, 0xF1, 0x2E, 0xBE, 0x6E, 0xBF, 0xE7, 0x97, 0xB7, 0xF7, 0xAF, 0x87, 0xD7, 0xB7,
+        0x6D, 0xF8, 0xBA, 0x1E, 0x3F, 0x3C, 0xED, 0xBF, 0xE7, 0xF5, 0x2E, 0x8B, 0x06, 0x5D, 0xBE, 0xCE,
+        0x17, 0x8B, 0x7E, 0x30, 0x9E, 0xFE, 0xBF, 0xAC, 0x07, 0xD1, 0x64, 0xBD, 0x8D, 0xAB, 0x78, 0x9A,
+        0x54, 0x8B, 0x2A, 0xF9, 0x7F, 0x3E, 0x5B, 0xCC, 0x37, 0xEB, 0x55, 0x16, 0x2C, 0xD2, 0x65, 0x3D,
+        0x1D, 0x4F, 0xFE, 0x9F, 0xCF, 0x92, 0x3A, 0x0F, 0xA3, 0x70, 0xBE, 0x1F, 0xB5, 0xE9, 0xBC, 0x1A,
+        0xFD, 0xBF, 0x06
+    };
+    {
+        uint8_t literals[96], encoded[sizeof(first_version)];
+        uint32_t literal_seed = 2024;
+        for(uint32_t i=0; i<96; ++i)
+        {
+            literal_seed = literal_seed * 1664525U + 1013904223U;
+            literals[i] = ((i % 16) == 15) ? (uint8_t)(200 + (literal_seed >> 29)) : (uint8_t)(16 + ((literal_seed >> 24) & 31));
+        }
+
+        le_stream stream;
+        le_model model;
+        le_init(&stream, encoded, sizeof(encoded));
+        le_model_init(&model);
+        le_begin_encode(&stream);
+        for(uint32_t i=0; i<96; ++i)
+            le_encode_literal(&stream, &model, literals[i]);
+        ASSERT_EQ(le_end_encode(&stream), sizeof(first_version));
+        ASSERT_MEM_EQ(first_version, encoded, sizeof(first_version));
+
+        le_init(&stream, (void*)first_version, sizeof(first_version));
+        le_model_init(&model);
+        le_begin_decode(&stream);
+        for(uint32_t i=0; i<96; ++i)
+            ASSERT_EQ(literals[i], le_decode_literal(&stream, &model));
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+    }
+
+    le_model model;
+    le_model_init(&model);
+    ASSERT_EQ(le_model_max_code_bits(&model), LE_MAX_CODE_BITS);
+    const uint8_t too_long[LE_Q_ESCAPE_SIZE] = {255, 255, 255, 255, 255, 255, 255, 255};
+    ASSERT_FALSE(le_model_set_escape(&model, too_long));
+    ASSERT_EQ(model.custom_escape, false);
+    ASSERT(le_model_set_escape(&model, q_escape_tight));
+    ASSERT_EQ(le_model_max_code_bits(&model), 17);
+
+    // small values with outliers
+    uint32_t seed = 777;
+    for(size_t i=0; i<size; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        input[i] = ((seed >> 24) < 12) ? (uint8_t)(128 + (seed & 127)) : (uint8_t)((seed >> 8) & 3);
+    }
+
+    size_t sizes[2];
+    for(uint32_t tight=0; tight<2; ++tight)
+    {
+        le_stream stream, bulk_stream;
+        le_model bulk_model;
+
+        le_init(&stream, buffer, sizeof(buffer));
+        le_model_init(&model);
+        if (tight)
+            le_model_set_escape(&model, q_escape_tight);
+        le_begin_encode(&stream);
+        for(size_t i=0; i<size; ++i)
+            le_encode_symbol(&stream, &model, input[i]);
+        sizes[tight] = le_end_encode(&stream);
+
+        le_init(&bulk_stream, bulk_buffer, sizeof(bulk_buffer));
+        le_model_init(&bulk_model);
+        if (tight)
+            le_model_set_escape(&bulk_model, q_escape_tight);
+        le_begin_encode(&bulk_stream);
+        le_encode_symbols(&bulk_stream, &bulk_model, input, size);
+        ASSERT_EQ(le_end_encode(&bulk_stream), sizes[tight]);
+        ASSERT_MEM_EQ(buffer, bulk_buffer, sizes[tight]);
+
+        le_init(&stream, buffer, sizes[tight]);
+        le_model_init(&model);
+        if (tight)
+            le_model_set_escape(&model, q_escape_tight);
+        le_begin_decode(&stream);
+        le_decode_symbols(&stream, &model, output, size);
+        le_end_decode(&stream);
+        ASSERT_EQ(stream.status, LE_OK);
+        ASSERT_MEM_EQ(input, output, size);
+    }
+    printf("outliers : %zu bytes, tight escape : %zu bytes\n", sizes[0], sizes[1]);
+
+    // snapshots keep the limits
+    uint8_t snapshot[LE_SNAPSHOT_SIZE];
+    le_model loaded;
+    le_model_save(&model, snapshot);
+    ASSERT(le_model_load(&loaded, snapshot, sizeof(snapshot)));
+    ASSERT_MEM_EQ(q_escape_tight, loaded.q_escape, LE_Q_ESCAPE_SIZE);
+    ASSERT(loaded.custom_escape);
+
+    PASS();
+}
+
+// encodes with the api into a buffer of exactly capacity bytes
+static le_status encode_bounded(le_model* model, const uint8_t* input, size_t count, le_api api, bool bulk,
+                                le_backend backend, uint8_t* buffer, size_t capacity)
+{
+    le_stream stream;
+    le_init(&stream, buffer, capacity);
+    le_set_backend(&stream, backend);
+    le_begin_encode(&stream);
+    for(size_t i=0; i<count; i += bulk ? count : 1)
+    {
+        size_t n = bulk ? count : 1;
+        switch (api)
+        {
+        case le_api_symbol : le_encode_symbols(&stream, model, input + i, n); break;
+        case le_api_literal : le_encode_literals(&stream, model, input + i, n); break;
+        case le_api_delta : le_encode_deltas(&stream, model, (const int8_t*)input + i, n); break;
+        }
+    }
+    le_end_encode(&stream);
+    return stream.status;
+}
+
+TEST max_encoded_size(void)
+{
+    enum {count = 4096};
+    static uint8_t inputs[4][count], buffer[LE_MAX_ENCODED_SIZE_RANGE(count)];
+    static uint32_t wide[count];
+
+    // the range coder bound : (2048 / 31)^8 <= 2^LE_RC_MAX_SYMBOL_BITS
+    uint64_t power = 1;
+    for(uint32_t i=0; i<8; ++i)
+        power *= (1U << LE_RC_MOVE_BITS) - 1;
+    ASSERT((1ULL << (8 * LE_RC_PROB_BITS - LE_RC_MAX_SYMBOL_BITS)) <= power);
+
+    // font atlas, uniform noise, outliers on zeros and the largest values
+    uint32_t seed = 4242;
+    for(size_t i=0; i<count; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        inputs[0][i] = default_font_atlas[i];
+        inputs[1][i] = (uint8_t)(seed >> 24);
+        inputs[2][i] = (i % 16 == 15) ? 255 : 0;
+        inputs[3][i] = 255;
+        wide[i] = (i & 1) ? 0xFFFFFFFFU : seed;
+    }
+
+    le_model model;
+    for(uint32_t d=0; d<4; ++d)
+    {
+        for(uint32_t api=le_api_symbol; api<=le_api_delta; ++api)
+        {
+            for(uint32_t variant=0; variant<3; ++variant)
+            {
+                le_model_init(&model);
+                if (variant == 2)
+                    le_model_enable_runs(&model);
+                ASSERT_EQ(encode_bounded(&model, inputs[d], count, (le_api)api, variant > 0, le_backend_rice, buffer,
+                                         LE_MAX_ENCODED_SIZE(count)), LE_OK);
+            }
+
+            le_model_init(&model);
+            le_model_set_escape(&model, q_escape_tight);
+            size_t bound = le_model_max_encoded_size(&model, count, le_backend_rice);
+            ASSERT(bound < LE_MAX_ENCODED_SIZE(count));
+            ASSERT_EQ(encode_bounded(&model, inputs[d], count, (le_api)api, true, le_backend_rice, buffer, bound), LE_OK);
+
+#ifdef LE_RANGE_CODER
+            le_model_init(&model);
+            ASSERT_EQ(encode_bounded(&model, inputs[d], count, (le_api)api, false, le_backend_range, buffer,
+                                     LE_MAX_ENCODED_SIZE_RANGE(count)), LE_OK);
+#endif
+        }
+    }
+
+#ifdef LE_RANGE_CODER
+    // the range coder with the least probable branch at every node
+    uint8_t* adversarial = inputs[0];
+    le_model_init(&model);
+    le_model probe = model;
+    for(size_t i=0; i<count; ++i)
+    {
+        uint32_t node = 1;
+        for(uint32_t b=0; b<8; ++b)
+            node = (node << 1) | (probe.probabilities[node] >= (1U << (LE_RC_PROB_BITS - 1)));
+        adversarial[i] = (uint8_t)node;
+
+        le_stream scratch;
+        uint8_t scratch_buffer[64];
+        le_init(&scratch, scratch_buffer, sizeof(scratch_buffer));
+        le_set_backend(&scratch, le_backend_range);
+        le_begin_encode(&scratch);
+        le_encode_literal(&scratch, &probe, adversarial[i]);
+    }
+    ASSERT_EQ(encode_bounded(&model, adversarial, count, le_api_literal, false, le_backend_range, buffer,
+                             LE_MAX_ENCODED_SIZE_RANGE(count)), LE_OK);
+#endif
+
+    // a model left in a long run by a previous session : the first symbol breaks the run, then escapes
+    ASSERT_EQ(1 + run_bits_for_index[LE_RUN_INDEX_MAX], LE_MAX_RUN_BREAK_BITS);
+    memset(inputs[0], 0, count);
+    le_model_init(&model);
+    le_model_enable_runs(&model);
+    for(uint32_t i=0; i<16; ++i)
+        ASSERT_EQ(encode_bounded(&model, inputs[0], count, le_api_symbol, true, le_backend_rice, buffer, sizeof(buffer)), LE_OK);
+    ASSERT(model.in_run);
+    ASSERT_EQ(model.run_index, LE_RUN_INDEX_MAX);
+    ASSERT_EQ(model.k, 0);
+
+    const uint8_t breaker = 255;
+    le_model run_model = model;
+    ASSERT_EQ(le_model_max_encoded_size(&run_model, 1, le_backend_rice), LE_MAX_ENCODED_SIZE(1));
+    ASSERT_EQ(encode_bounded(&run_model, &breaker, 1, le_api_symbol, true, le_backend_rice, buffer, LE_MAX_ENCODED_SIZE(1)), LE_OK);
+    run_model = model;
+    ASSERT_EQ(encode_bounded(&run_model, &breaker, 1, le_api_symbol, true, le_backend_rice, buffer, (LE_MAX_CODE_BITS + 7) / 8),
+              LE_BUFFER_OVERRUN);
+
+    // wide values
+    le_stream stream;
+    le_init(&stream, buffer, LE_MAX_ENCODED_SIZE32(count));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_literals32(&stream, &model, wide, count);
+    le_end_encode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    le_init(&stream, buffer, LE_MAX_ENCODED_SIZE16(count));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(size_t i=0; i<count; ++i)
+        le_encode_literal16(&stream, &model, (uint16_t)wide[i]);
+    le_end_encode(&stream);
+    ASSERT_EQ(stream.status, LE_OK);
+
+    PASS();
+}
+
+TEST estimate(void)
+{
+    enum {count = 16384};
+    static uint8_t inputs[4][count], buffer[LE_MAX_ENCODED_SIZE(count)];
+    static const size_t chunks[] = {0, 1000, 1017, 9000, count};
+
+    // font atlas, frames switching between small and large values, a slow ramp (deltas) and runs
+    uint32_t seed = 777;
+    for(size_t i=0; i<count; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        inputs[0][i] = default_font_atlas[i % default_font_atlas_size];
+        inputs[1][i] = ((i / 512) & 1) ? (uint8_t)(64 + ((seed >> 24) & 127)) : (uint8_t)((seed >> 24) & 3);
+        inputs[2][i] = (uint8_t)(i / 3 + ((seed >> 24) & 1));
+        inputs[3][i] = ((i / 200) & 1) ? 7 : (uint8_t)((seed >> 24) & 15);
+    }
+
+    le_k_params dual = le_default_k_params;
+    dual.fast_threshold = 3;
+    le_k_params wide_band = {.initial_k = 0, .threshold = 4, .low = 2, .high = 2, .fast_threshold = 0};
+
+    for(uint32_t d=0; d<4; ++d)
+    {
+        for(uint32_t api=le_api_symbol; api<=le_api_delta; ++api)
+        {
+            for(uint32_t variant=0; variant<5; ++variant)
+            {
+                // default, dual rate, tight escape, other bands, zero-run mode
+                le_model model, estimated;
+                le_model_init_params(&model, (variant == 1) ? &dual : (variant == 3) ? &wide_band : &le_default_k_params);
+                if (variant == 2)
+                    le_model_set_escape(&model, q_escape_tight);
+                if (variant == 4)
+                    le_model_enable_runs(&model);
+                estimated = model;
+
+                // the same chunks for both : the zero-run mode closes the runs at the end of a call
+                le_stream stream;
+                le_init(&stream, buffer, sizeof(buffer));
+                le_begin_encode(&stream);
+                uint64_t bits = 0;
+                for(uint32_t c=0; c<4; ++c)
+                {
+                    const uint8_t* input = inputs[d] + chunks[c];
+                    size_t n = chunks[c + 1] - chunks[c];
+                    switch (api)
+                    {
+                    case le_api_symbol : le_encode_symbols(&stream, &model, input, n); break;
+                    case le_api_literal : le_encode_literals(&stream, &model, input, n); break;
+                    case le_api_delta : le_encode_deltas(&stream, &model, (const int8_t*)input, n); break;
+                    }
+                    bits += le_estimate(&estimated, input, n, (le_api)api);
+                }
+                ASSERT_EQ(le_end_encode(&stream), (size_t)((bits + 7) / 8));
+
+                // the model ends in the encoder state
+                ASSERT_EQ(estimated.k, model.k);
+                ASSERT_EQ(estimated.k_trend, model.k_trend);
+                ASSERT_EQ(estimated.k_fast_trend, model.k_fast_trend);
+                ASSERT_MEM_EQ(estimated.alphabet, model.alphabet, LE_ALPHABET_SIZE);
+            }
+        }
+    }
+
+    // the best api is the smallest stream, the model doesn't change
+    for(uint32_t d=0; d<4; ++d)
+    {
+        le_model model;
+        le_model_init(&model);
+        uint64_t bits;
+        le_api best = le_estimate_best_api(&model, inputs[d], count, &bits);
+        ASSERT_EQ(model.k, 2);
+        ASSERT_EQ(model.alphabet[1], 1);
+
+        size_t best_size = le_encode_block(inputs[d], count, buffer, sizeof(buffer), best);
+        ASSERT_EQ(best_size, (size_t)((bits + 7) / 8));
+        for(uint32_t api=le_api_symbol; api<=le_api_delta; ++api)
+            ASSERT(best_size <= le_encode_block(inputs[d], count, buffer, sizeof(buffer), (le_api)api));
+    }
+
+    PASS();
+}
+
+typedef void (*index_increment_func)(uint8_t* index, uint32_t first, uint32_t count);
+
+TEST index_increment(void)
+{
+    // encoder and decoder share the same path, a round trip can't catch a wrong vector version
+    const index_increment_func variants[] =
+    {
+        le_index_increment,
+#if defined(LE_AVX2)
+        le_index_increment_avx2,
+#endif
+#if defined(LE_SSE2)
+        le_index_increment_sse2,
+#endif
+#if defined(LE_NEON)
+        le_index_increment_neon,
+#endif
+    };
+
+    // a permutation like the alphabet index and random bytes
+    uint8_t tables[2][LE_ALPHABET_SIZE];
+    uint32_t seed = 31337;
+    for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        tables[0][i] = (uint8_t)(i * 167 + 13);
+        tables[1][i] = (uint8_t)(seed >> 24);
+    }
+
+    // every range, which covers the ones around LE_PROMOTE_SIMD_MIN and at both ends of the alphabet
+    for(uint32_t v=0; v<sizeof(variants) / sizeof(variants[0]); ++v)
+        for(uint32_t t=0; t<2; ++t)
+            for(uint32_t first=0; first<LE_ALPHABET_SIZE; ++first)
+                for(uint32_t count=1; first + count<=LE_ALPHABET_SIZE; ++count)
+                {
+                    uint8_t expected[LE_ALPHABET_SIZE], result[LE_ALPHABET_SIZE];
+                    memcpy(expected, tables[t], LE_ALPHABET_SIZE);
+                    memcpy(result, tables[t], LE_ALPHABET_SIZE);
+                    le_index_increment_scalar(expected, first, count);
+                    variants[v](result, first, count);
+                    ASSERT_MEM_EQ(expected, result, LE_ALPHABET_SIZE);
+                }
+
+    PASS();
+}
+
+#ifdef LE_STATS
+TEST stats(void)
+{
+    static uint8_t buffer[32768];
+    static uint8_t output[32768];
+
+    le_stream stream;
+    le_model model, bulk_model;
+
+    le_init(&stream, buffer, sizeof(buffer));
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    for(uint32_t i=0; i<default_font_atlas_size; ++i)
+        le_encode_symbol(&stream, &model, default_font_atlas[i]);
+    size_t size = le_end_encode(&stream);
+
+    le_model_stats_dump(&model, stdout);
+
+    const le_model_stats* stats = &model.stats;
+    ASSERT_EQ(stats->values, default_font_atlas_size);
+    ASSERT_EQ((stats->bits + 7) / 8, size);
+
+    uint64_t sum = 0;
+    for(uint32_t k=0; k<8; ++k)
+        sum += stats->k_histogram[k];
+    ASSERT_EQ(sum, stats->values);
+
+    sum = 0;
+    for(uint32_t i=0; i<LE_ALPHABET_SIZE; ++i)
+        sum += stats->index_histogram[i];
+    ASSERT_EQ(sum, stats->values);
+    ASSERT_EQ(stats->k_increases + 2, stats->k_decreases + model.k);
+
+    // bulk decoding gathers the same statistics
+    le_init(&stream, buffer, size);
+    le_model_init(&bulk_model);
+    le_begin_decode(&stream);
+    le_decode_symbols(&stream, &bulk_model, output, default_font_atlas_size);
+    ASSERT_MEM_EQ(stats, &bulk_model.stats, sizeof(le_model_stats));
+
+    // training gathers them too, without a stream
+    le_model_init(&bulk_model);
+    le_model_train(&bulk_model, default_font_atlas, default_font_atlas_size, le_api_symbol);
+    ASSERT_MEM_EQ(stats, &bulk_model.stats, sizeof(le_model_stats));
+
+#ifdef LE_RANGE_CODER
+    // the range coder has no codewords : its values aren't counted in bits
+    le_init(&stream, buffer, sizeof(buffer));
+    le_set_backend(&stream, le_backend_range);
+    le_model_init(&model);
+    le_begin_encode(&stream);
+    le_encode_symbols(&stream, &model, default_font_atlas, default_font_atlas_size);
+    ASSERT(le_end_encode(&stream) > 0);
+    le_model_stats_dump(&model, stdout);
+    ASSERT_EQ(stats->values, default_font_atlas_size);
+    ASSERT_EQ(stats->range_values, default_font_atlas_size);
+    ASSERT_EQ(stats->bits, 0);
+    ASSERT_EQ(stats->escapes, 0);
+#endif
+
+    PASS();
+}
+#endif
 
 GREATEST_MAIN_DEFS();
 
@@ -108,6 +1705,30 @@ int main(void)
     RUN_TEST(symbols);
     RUN_TEST(delta);
     RUN_TEST(overrun);
+    RUN_TEST(padded);
+    RUN_TEST(sink);
+    RUN_TEST(source);
+    RUN_TEST(unchecked);
+    RUN_TEST(bulk_decode);
+    RUN_TEST(bulk);
+    RUN_TEST(blocks);
+    RUN_TEST(frame);
+    RUN_TEST(wide);
+    RUN_TEST(runs);
+#ifdef LE_RANGE_CODER
+    RUN_TEST(range_backend);
+#endif
+    RUN_TEST(context_model);
+    RUN_TEST(snapshot);
+    RUN_TEST(promote_policies);
+    RUN_TEST(k_params);
+    RUN_TEST(escape);
+    RUN_TEST(max_encoded_size);
+    RUN_TEST(estimate);
+    RUN_TEST(index_increment);
+#ifdef LE_STATS
+    RUN_TEST(stats);
+#endif
 
     GREATEST_MAIN_END();
 }
@@ -0,0 +1,140 @@
+#ifndef LE_TOOLS_CORPUS_H
+#define LE_TOOLS_CORPUS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+// sample files loaded in memory, shared by the tools
+
+typedef struct sample
+{
+    uint8_t* data;
+    size_t size;
+} sample;
+
+typedef struct corpus
+{
+    sample* samples;
+    size_t count;
+    size_t capacity;
+    size_t total_size;
+} corpus;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool add_file(corpus* c, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = (size > 0) ? (uint8_t*)malloc((size_t)size) : NULL;
+    bool success = (size == 0) || (data != NULL && fread(data, 1, (size_t)size, file) == (size_t)size);
+    fclose(file);
+
+    if (!success)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        free(data);
+        return false;
+    }
+
+    if (c->count == c->capacity)
+    {
+        c->capacity = (c->capacity == 0) ? 64 : c->capacity * 2;
+        c->samples = (sample*)realloc(c->samples, c->capacity * sizeof(sample));
+    }
+
+    c->samples[c->count++] = (sample){.data = data, .size = (size_t)size};
+    c->total_size += (size_t)size;
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// adds a file or all the files of a directory (recursively)
+static bool add_path(corpus* c, const char* path)
+{
+    char child[4096];
+
+#if defined(_WIN32)
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+        return add_file(c, path);
+
+    WIN32_FIND_DATAA entry;
+    snprintf(child, sizeof(child), "%s\\*", path);
+    HANDLE find = FindFirstFileA(child, &entry);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool success = true;
+    do
+    {
+        if (strcmp(entry.cFileName, ".") == 0 || strcmp(entry.cFileName, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s\\%s", path, entry.cFileName);
+        success &= add_path(c, child);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+    return success;
+#else
+    struct stat info;
+    if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode))
+        return add_file(c, path);
+
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    bool success = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        success &= add_path(c, child);
+    }
+    closedir(dir);
+    return success;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static size_t corpus_max_size(const corpus* c)
+{
+    size_t max_size = 0;
+    for (size_t i = 0; i < c->count; ++i)
+        max_size = (c->samples[i].size > max_size) ? c->samples[i].size : max_size;
+    return max_size;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void corpus_free(corpus* c)
+{
+    for (size_t i = 0; i < c->count; ++i)
+        free(c->samples[i].data);
+    free(c->samples);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef LE_TOOLS_THREAD_POOL_H
+#define LE_TOOLS_THREAD_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// parallel_for callback on pthreads for le_encode_blocks/le_decode_blocks, shared by the bench and the tools.
+// Include it after lite_encoding.h, user_data points to the thread count (uint32_t, up to MAX_THREADS).
+
+#define MAX_THREADS (64)
+
+#if !defined(_WIN32)
+    #include <pthread.h>
+    #define THREAD_POOL
+
+typedef struct thread_pool
+{
+    pthread_mutex_t mutex;
+    le_job_func job;
+    void* context;
+    size_t next;
+    size_t count;
+} thread_pool;
+
+typedef struct worker
+{
+    pthread_t thread;
+    thread_pool* pool;
+    bool success;
+} worker;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void* worker_run(void* arg)
+{
+    worker* w = (worker*) arg;
+    for(;;)
+    {
+        pthread_mutex_lock(&w->pool->mutex);
+        size_t index = w->pool->next++;
+        pthread_mutex_unlock(&w->pool->mutex);
+
+        if (index >= w->pool->count)
+            break;
+
+        w->success &= w->pool->job(w->pool->context, index);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// the calling thread is one of the workers : if some threads can't be created the jobs still run, on fewer threads
+static bool parallel_for_threads(void* user_data, le_job_func job, void* context, size_t count)
+{
+    uint32_t thread_count = *(const uint32_t*) user_data;
+    thread_pool pool = {.job = job, .context = context, .next = 0, .count = count};
+    worker workers[MAX_THREADS];
+
+    if (pthread_mutex_init(&pool.mutex, NULL) != 0)
+        return le_parallel_for_sequential(NULL, job, context, count);
+
+    thread_count = (thread_count < 1) ? 1 : (thread_count > MAX_THREADS) ? MAX_THREADS : thread_count;
+    uint32_t started = 0;
+    for (; started + 1 < thread_count; ++started)
+    {
+        workers[started].pool = &pool;
+        workers[started].success = true;
+        if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]) != 0)
+            break;
+    }
+
+    worker self = {.pool = &pool, .success = true};
+    worker_run(&self);
+
+    bool success = self.success;
+    for (uint32_t i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+        success &= workers[i].success;
+    }
+    pthread_mutex_destroy(&pool.mutex);
+    return success;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lite_encoding.h"
+#include "corpus.h"
+
+// builds a model snapshot from sample files : the model is trained on every file in order, then the compressed size of
+// each file is measured with a fresh model and with the snapshot
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// compressed size of every sample coded on its own, from a fresh model or from the snapshot, false on error
+static bool measure(const corpus* c, le_api api, const uint8_t* snapshot, size_t* total)
+{
+    size_t capacity = LE_MAX_ENCODED_SIZE(corpus_max_size(c));
+    uint8_t* buffer = (uint8_t*)malloc(capacity);
+    if (buffer == NULL)
+        return false;
+
+    bool success = true;
+    *total = 0;
+    for (size_t i = 0; i < c->count && success; ++i)
+    {
+        le_stream s;
+        le_model model;
+
+        le_init(&s, buffer, capacity);
+        if (snapshot != NULL)
+            success = le_model_load(&model, snapshot, LE_SNAPSHOT_SIZE);
+        else
+            le_model_init(&model);
+
+        le_begin_encode(&s);
+        switch (api)
+        {
+        case le_api_symbol : le_encode_symbols(&s, &model, c->samples[i].data, c->samples[i].size); break;
+        case le_api_literal : le_encode_literals(&s, &model, c->samples[i].data, c->samples[i].size); break;
+        case le_api_delta : le_encode_deltas(&s, &model, (const int8_t*)c->samples[i].data, c->samples[i].size); break;
+        }
+        *total += le_end_encode(&s);
+        success = success && (s.status == LE_OK);
+    }
+
+    free(buffer);
+    return success;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool write_binary(const char* path, const uint8_t* snapshot)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    bool success = fwrite(snapshot, 1, LE_SNAPSHOT_SIZE, file) == LE_SNAPSHOT_SIZE;
+    return (fclose(file) == 0) && success;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool write_header(const char* path, const char* name, const uint8_t* snapshot)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "// generated by the train tool, load with le_model_load(&model, %s, sizeof(%s))\n", name, name);
+    fprintf(file, "static const uint8_t %s[%u] =\n{", name, (uint32_t)LE_SNAPSHOT_SIZE);
+    for (uint32_t i = 0; i < LE_SNAPSHOT_SIZE; ++i)
+        fprintf(file, "%s0x%02x,", (i % 16 == 0) ? "\n    " : " ", snapshot[i]);
+    fprintf(file, "\n};\n");
+
+    return fclose(file) == 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void print_usage(void)
+{
+    printf("usage : train [--api symbol|literal|delta] [--header name] [-o output] <files or directories>\n"
+           "  writes the snapshot of a model trained on the files, as binary (default snapshot.bin)\n"
+           "  or as a C header declaring the array 'name' with --header\n");
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    le_api api = le_api_symbol;
+    const char* header_name = NULL;
+    const char* output = NULL;
+    corpus c = {0};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--api") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "symbol") == 0)
+                api = le_api_symbol;
+            else if (strcmp(argv[i], "literal") == 0)
+                api = le_api_literal;
+            else if (strcmp(argv[i], "delta") == 0)
+                api = le_api_delta;
+            else
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--header") == 0 && i + 1 < argc)
+            header_name = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (argv[i][0] == '-')
+        {
+            print_usage();
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+        else if (!add_path(&c, argv[i]))
+            return 1;
+    }
+
+    if (c.count == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    le_model model;
+    le_model_init(&model);
+    for (size_t i = 0; i < c.count; ++i)
+        le_model_train(&model, c.samples[i].data, c.samples[i].size, api);
+
+    uint8_t snapshot[LE_SNAPSHOT_SIZE];
+    le_model_save(&model, snapshot);
+
+    size_t fresh, primed;
+    if (!measure(&c, api, NULL, &fresh) || !measure(&c, api, snapshot, &primed))
+    {
+        fprintf(stderr, "measure failed\n");
+        corpus_free(&c);
+        return 1;
+    }
+
+    printf("%zu files, %zu bytes\n", c.count, c.total_size);
+    printf("fresh models : %zu bytes, snapshot : %zu bytes (%.1f%%)\n", fresh, primed, (fresh > 0) ? 100.0 * (double)primed / (double)fresh : 0.0);
+
+    if (output == NULL)
+        output = (header_name != NULL) ? "snapshot.h" : "snapshot.bin";
+
+    bool success = (header_name != NULL) ? write_header(output, header_name, snapshot) : write_binary(output, snapshot);
+    if (!success)
+        fprintf(stderr, "can't write %s\n", output);
+
+    corpus_free(&c);
+    return success ? 0 : 1;
+}
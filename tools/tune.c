@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define LE_FREQUENCY_RANKING
+#include "../lite_encoding.h"
+#include "corpus.h"
+#include "thread_pool.h"
+
+#if !defined(_WIN32)
+    #include <time.h>
+#endif
+
+// searches the soft-K parameters, the escape limits and the promotion policy for a corpus : every setting of the grid is measured on
+// multiple threads (each sample coded on its own with a fresh model), then the best ones are timed
+
+static const uint8_t initial_ks[] = {1, 2, 3};
+static const uint8_t thresholds[] = {4, 6, 8, 12, 16, 24};
+static const uint8_t lows[] = {1, 2};
+static const uint8_t highs[] = {2, 3, 4};
+static const uint8_t fast_thresholds[] = {0, 2, 3, 4};
+static const le_promote_policy policies[] = {le_promote_half, le_promote_front, le_promote_quarter, le_promote_step,
+                                             le_promote_frequency};
+static const char* policy_names[] = {"half", "front", "quarter", "step", "frequency"};
+static const uint8_t* escapes[] = {q_escape_for_k, q_escape_tight};
+static const char* escape_names[] = {"default", "tight"};
+
+#define COUNT_OF(array) (sizeof(array) / sizeof(array[0]))
+
+typedef struct setting
+{
+    le_k_params params;
+    uint32_t policy;    // index in policies[]
+    uint32_t escape;    // index in escapes[]
+    uint32_t id;        // position in the grid, breaks the ties
+    size_t compressed_size;
+    double encode;      // MB/s
+    double decode;
+} setting;
+
+typedef struct search
+{
+    const corpus* c;
+    le_api api;
+    setting* settings;
+    size_t count;
+    size_t capacity;    // of the encoding buffers, the worst case of the largest sample
+} search;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static double now(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static size_t encode_sample(const search* ctx, const setting* config, const sample* input, uint8_t* buffer)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, buffer, ctx->capacity);
+    le_model_init_params(&model, &config->params);
+    le_model_set_escape(&model, escapes[config->escape]);
+    le_begin_encode(&s);
+    switch (ctx->api)
+    {
+    case le_api_symbol : le_encode_symbols_ex(&s, &model, input->data, input->size, policies[config->policy]); break;
+    case le_api_literal : le_encode_literals(&s, &model, input->data, input->size); break;
+    case le_api_delta : le_encode_deltas(&s, &model, (const int8_t*)input->data, input->size); break;
+    }
+    return le_end_encode(&s);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool decode_sample(const search* ctx, const setting* config, uint8_t* buffer, size_t size, uint8_t* output,
+                          size_t count)
+{
+    le_stream s;
+    le_model model;
+
+    le_init(&s, buffer, size);
+    le_model_init_params(&model, &config->params);
+    le_model_set_escape(&model, escapes[config->escape]);
+    le_begin_decode(&s);
+    switch (ctx->api)
+    {
+    case le_api_symbol : le_decode_symbols_ex(&s, &model, output, count, policies[config->policy]); break;
+    case le_api_literal : le_decode_literals(&s, &model, output, count); break;
+    case le_api_delta : le_decode_deltas(&s, &model, (int8_t*)output, count); break;
+    }
+    le_end_decode(&s);
+    return s.status == LE_OK;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool measure_job(void* context, size_t index)
+{
+    search* ctx = (search*)context;
+    setting* config = &ctx->settings[index];
+    uint8_t* buffer = (uint8_t*)malloc(ctx->capacity);
+    if (buffer == NULL)
+        return false;
+
+    config->compressed_size = 0;
+    for (size_t i = 0; i < ctx->c->count; ++i)
+        config->compressed_size += encode_sample(ctx, config, &ctx->c->samples[i], buffer);
+
+    free(buffer);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// throughput of the whole corpus, best of the repetitions. Each sample is encoded then decoded in the same buffer,
+// only the coding calls are timed
+static bool time_setting(const search* ctx, setting* config, uint32_t repetitions)
+{
+    const corpus* c = ctx->c;
+    uint8_t* compressed = (uint8_t*)malloc(ctx->capacity);
+    uint8_t* output = (uint8_t*)malloc(corpus_max_size(c) + 1);
+    bool success = (compressed != NULL && output != NULL);
+    double megabytes = (double)c->total_size / (1024.0 * 1024.0);
+
+    config->encode = config->decode = 0.0;
+    for (uint32_t r = 0; r < repetitions && success; ++r)
+    {
+        double encode_time = 0.0, decode_time = 0.0;
+        for (size_t i = 0; i < c->count && success; ++i)
+        {
+            double start = now();
+            size_t size = encode_sample(ctx, config, &c->samples[i], compressed);
+            double middle = now();
+            success = decode_sample(ctx, config, compressed, size, output, c->samples[i].size);
+            encode_time += middle - start;
+            decode_time += now() - middle;
+
+            // round trip check, outside of the timings
+            success = success && (c->samples[i].size == 0 || memcmp(output, c->samples[i].data, c->samples[i].size) == 0);
+        }
+        config->encode = (megabytes / encode_time > config->encode) ? megabytes / encode_time : config->encode;
+        config->decode = (megabytes / decode_time > config->decode) ? megabytes / decode_time : config->decode;
+    }
+
+    free(compressed);
+    free(output);
+    return success;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int compare_settings(const void* a, const void* b)
+{
+    const setting* sa = (const setting*)a;
+    const setting* sb = (const setting*)b;
+    if (sa->compressed_size != sb->compressed_size)
+        return (sa->compressed_size < sb->compressed_size) ? -1 : 1;
+    return (sa->id < sb->id) ? -1 : (sa->id > sb->id);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void print_setting(const char* rank, const setting* config, le_api api, size_t total_size)
+{
+    printf("%-9s %-9s %-7s %9u %9u %3u %4u %4u %12zu %6.3f %9.1f %9.1f\n", rank,
+           (api == le_api_symbol) ? policy_names[config->policy] : "-", escape_names[config->escape],
+           config->params.initial_k, config->params.threshold, config->params.low, config->params.high,
+           config->params.fast_threshold, config->compressed_size,
+           (total_size > 0) ? (double)config->compressed_size / (double)total_size : 0.0, config->encode, config->decode);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static bool write_header(const char* path, const char* name, const setting* config, size_t count)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    char prefix[256];
+    size_t length = 0;
+    for (; name[length] != 0 && length < sizeof(prefix) - 1; ++length)
+        prefix[length] = (char)toupper((unsigned char)name[length]);
+    prefix[length] = 0;
+
+    fprintf(file, "// generated by the tune tool on %zu files : %zu bytes\n", count, config->compressed_size);
+    fprintf(file, "// #define LE_PROMOTE_POLICY %s_POLICY before including lite_encoding.h (or use the _ex functions)\n", prefix);
+    fprintf(file, "// le_k_params params = %s_K_PARAMS; le_model_init_params(&model, &params);\n", prefix);
+    fprintf(file, "// static const uint8_t q_escape[LE_Q_ESCAPE_SIZE] = %s_Q_ESCAPE; le_model_set_escape(&model, q_escape);\n", prefix);
+    if (policies[config->policy] == le_promote_frequency)
+    {
+        // the policy and the counts it needs only exist with LE_FREQUENCY_RANKING
+        fprintf(file, "// le_promote_frequency : define LE_FREQUENCY_RANKING before including lite_encoding.h and this header\n");
+        fprintf(file, "#ifndef LE_FREQUENCY_RANKING\n");
+        fprintf(file, "    #error \"%s_POLICY needs LE_FREQUENCY_RANKING\"\n", prefix);
+        fprintf(file, "#endif\n");
+    }
+    fprintf(file, "#define %s_POLICY le_promote_%s\n", prefix, policy_names[config->policy]);
+    fprintf(file, "#define %s_K_PARAMS {.initial_k = %u, .threshold = %u, .low = %u, .high = %u, .fast_threshold = %u}\n",
+            prefix, config->params.initial_k, config->params.threshold, config->params.low, config->params.high,
+            config->params.fast_threshold);
+    fprintf(file, "#define %s_Q_ESCAPE {", prefix);
+    for (uint32_t k = 0; k < LE_Q_ESCAPE_SIZE; ++k)
+        fprintf(file, "%s%u", (k > 0) ? ", " : "", escapes[config->escape][k]);
+    fprintf(file, "}\n");
+
+    return fclose(file) == 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// snapshot of a model trained on the corpus with the best parameters, the policy isn't part of it
+static bool write_snapshot(const char* path, const corpus* c, le_api api, const setting* config)
+{
+    le_model model;
+    le_model_init_params(&model, &config->params);
+    le_model_set_escape(&model, escapes[config->escape]);
+    for (size_t i = 0; i < c->count; ++i)
+        le_model_train(&model, c->samples[i].data, c->samples[i].size, api);
+
+    uint8_t snapshot[LE_SNAPSHOT_SIZE];
+    le_model_save(&model, snapshot);
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    bool success = fwrite(snapshot, 1, LE_SNAPSHOT_SIZE, file) == LE_SNAPSHOT_SIZE;
+    return (fclose(file) == 0) && success;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void print_usage(void)
+{
+    printf("usage : tune [--api symbol|literal|delta] [--threads N] [--top N] [--reps N] [--header name] [-o output]\n"
+           "            <files or directories>\n"
+           "  measures every setting of the grid, times the --top best ones (default 8)\n"
+           "  writes the best setting as a config header with --header, or as a snapshot with -o\n");
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    le_api api = le_api_symbol;
+    uint32_t threads = 4, top = 8, repetitions = 5;
+    const char* header_name = NULL;
+    const char* output = NULL;
+    corpus c = {0};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--api") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "symbol") == 0)
+                api = le_api_symbol;
+            else if (strcmp(argv[i], "literal") == 0)
+                api = le_api_literal;
+            else if (strcmp(argv[i], "delta") == 0)
+                api = le_api_delta;
+            else
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+            top = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            repetitions = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--header") == 0 && i + 1 < argc)
+            header_name = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (argv[i][0] == '-')
+        {
+            print_usage();
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+        else if (!add_path(&c, argv[i]))
+            return 1;
+    }
+
+    if (c.count == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    threads = (threads < 1) ? 1 : (threads > MAX_THREADS) ? MAX_THREADS : threads;
+    repetitions = (repetitions < 1) ? 1 : repetitions;
+
+    // the policy only matters for the symbols, the default setting comes first
+    uint32_t policy_count = (api == le_api_symbol) ? (uint32_t)COUNT_OF(policies) : 1;
+    size_t count = 1 + policy_count * COUNT_OF(escapes) * COUNT_OF(initial_ks) * COUNT_OF(thresholds) * COUNT_OF(lows) * COUNT_OF(highs) *
+                   COUNT_OF(fast_thresholds);
+    search ctx = {.c = &c, .api = api, .count = count, .capacity = LE_MAX_ENCODED_SIZE(corpus_max_size(&c))};
+    ctx.settings = (setting*)calloc(count, sizeof(setting));
+    if (ctx.settings == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        corpus_free(&c);
+        return 1;
+    }
+
+    ctx.settings[0].params = le_default_k_params;
+    size_t n = 1;
+    for (uint32_t p = 0; p < policy_count; ++p)
+        for (uint32_t e = 0; e < COUNT_OF(escapes); ++e)
+            for (uint32_t k = 0; k < COUNT_OF(initial_ks); ++k)
+                for (uint32_t t = 0; t < COUNT_OF(thresholds); ++t)
+                    for (uint32_t l = 0; l < COUNT_OF(lows); ++l)
+                        for (uint32_t h = 0; h < COUNT_OF(highs); ++h)
+                            for (uint32_t f = 0; f < COUNT_OF(fast_thresholds); ++f)
+                            {
+                                ctx.settings[n].policy = p;
+                                ctx.settings[n].escape = e;
+                                ctx.settings[n].id = (uint32_t)n;
+                                ctx.settings[n++].params = (le_k_params){.initial_k = initial_ks[k], .threshold = thresholds[t],
+                                                                         .low = lows[l], .high = highs[h],
+                                                                         .fast_threshold = fast_thresholds[f]};
+                            }
+
+    printf("%zu files, %zu bytes, %zu settings on %u threads\n", c.count, c.total_size, count, threads);
+
+#if defined(THREAD_POOL)
+    bool success = parallel_for_threads(&threads, measure_job, &ctx, count);
+#else
+    bool success = le_parallel_for_sequential(NULL, measure_job, &ctx, count);
+#endif
+
+    setting reference = ctx.settings[0];
+    success = success && time_setting(&ctx, &reference, repetitions);
+    qsort(ctx.settings, count, sizeof(setting), compare_settings);
+
+    top = (top > count) ? (uint32_t)count : top;
+    printf("\n%-9s %-9s %-7s %9s %9s %3s %4s %4s %12s %6s %9s %9s\n", "rank", "policy", "escape", "initial_k", "threshold", "low", "high",
+           "fast", "bytes", "ratio", "enc MB/s", "dec MB/s");
+    print_setting("default", &reference, api, c.total_size);
+    for (uint32_t i = 0; i < top && success; ++i)
+    {
+        char rank[16];
+        snprintf(rank, sizeof(rank), "%u", i + 1);
+        success = time_setting(&ctx, &ctx.settings[i], repetitions);
+        print_setting(rank, &ctx.settings[i], api, c.total_size);
+    }
+
+    if (!success)
+        fprintf(stderr, "measure failed\n");
+    else if (header_name != NULL || output != NULL)
+    {
+        if (output == NULL)
+            output = "config.h";
+
+        if (header_name != NULL)
+            success = write_header(output, header_name, &ctx.settings[0], c.count);
+        else
+            success = write_snapshot(output, &c, api, &ctx.settings[0]);
+
+        if (!success)
+            fprintf(stderr, "can't write %s\n", output);
+        else if (header_name == NULL && api == le_api_symbol)
+            printf("the snapshot doesn't store the policy, use le_promote_%s\n", policy_names[ctx.settings[0].policy]);
+    }
+
+    free(ctx.settings);
+    corpus_free(&c);
+    return success ? 0 : 1;
+}